@@ -0,0 +1,98 @@
+#!/bin/sh
+#
+# Replay every configuration in golden/matrix and compare against its
+# golden output.  With -u the goldens are rewritten instead.  Rows marked
+# =plain are also run plain with -q, and their final statistics must be
+# the same apart from the report sections only their mode prints.  The
+# plain run of a program row replays the trace the program dumped.
+#
+
+update=0
+if [ "$1" = "-u" ]; then
+    update=1
+fi
+
+dir=golden
+tmp=${TMPDIR:-/tmp}/iplc-check.$$
+failed=0
+ran=0
+trap 'rm -f $tmp.trace $tmp.ipt $tmp.out $tmp.plain $tmp.out.stats $tmp.plain.stats' EXIT
+
+# final statistics, without the sections of modes that must not change them
+stats() {
+    sed -n '/^ Cache Performance/,$p' "$1" |
+        sed '/^ Basic Block Mode/,/^$/d; /^ Loop Extrapolation/,/^$/d; /^ Functional Front-End/,/^$/d'
+}
+
+grep -v '^#' $dir/matrix | grep -v '^ *$' | {
+while read name trace index blocksize assoc taken options; do
+    case $trace in
+        gen:*)
+            ./iplc-gen $(echo ${trace#gen:} | tr ',' ' ') -o $tmp.trace || exit 2
+            trace=$tmp.trace
+            ;;
+        dump:*)
+            printf "%s %s %s\n%s\n" $index $blocksize $assoc $taken |
+                ./iplc-sim -q -F program=${trace#dump:},dump=$tmp.trace > /dev/null || exit 2
+            trace=$tmp.trace
+            ;;
+    esac
+    plain_trace=$trace
+    program=""
+    case $trace in
+        ipt:*)
+            printf "%s\n" ${trace#ipt:} | ./iplc-sim -Z $tmp.ipt > /dev/null || exit 2
+            plain_trace=${trace#ipt:}
+            trace=$tmp.ipt
+            ;;
+        prog:*)
+            # no tracefile prompt, the program takes its place
+            program="-F program=${trace#prog:},dump=$tmp.trace"
+            plain_trace=$tmp.trace
+            ;;
+    esac
+
+    # the plain run keeps every option but the mode under test
+    same=0
+    plain=""
+    run=""
+    for option in $options; do
+        case $option in
+            =plain) same=1 ;;
+            -b|-L) run="$run $option" ;;
+            *) run="$run $option"; plain="$plain $option" ;;
+        esac
+    done
+
+    ran=$((ran + 1))
+    if [ -n "$program" ]; then
+        printf "%s %s %s\n%s\n" $index $blocksize $assoc $taken | ./iplc-sim $program $run > $tmp.out
+    else
+        printf "%s\n%s %s %s\n%s\n" $trace $index $blocksize $assoc $taken | ./iplc-sim $run > $tmp.out
+    fi
+    if [ $update = 1 ]; then
+        gzip -9n < $tmp.out > $dir/$name.out.gz
+        echo "updated $name"
+        continue
+    fi
+    if ! ./iplc-check $dir/$name.out.gz $tmp.out; then
+        echo "FAILED  $name"
+        failed=$((failed + 1))
+        continue
+    fi
+    if [ $same = 1 ]; then
+        printf "%s\n%s %s %s\n%s\n" $plain_trace $index $blocksize $assoc $taken |
+            ./iplc-sim -q $plain > $tmp.plain
+        stats $tmp.out > $tmp.out.stats
+        stats $tmp.plain > $tmp.plain.stats
+        if ! cmp -s $tmp.out.stats $tmp.plain.stats; then
+            echo "FAILED  $name differs from the plain run"
+            failed=$((failed + 1))
+            continue
+        fi
+    fi
+    echo "ok      $name"
+done
+echo "$ran configurations, $failed failed"
+[ $failed = 0 ]
+}
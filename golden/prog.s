@@ -0,0 +1,33 @@
+# Sums a 16 word array, then calls a function that writes the array
+# doubled 256 bytes further on, and exits.  Replayed by make check with
+# -F program=golden/prog.s, directly and through its dump= trace.
+#
+# sum the array at 0x10010000 into $s0
+0x00400000  lui $t1, 0x1001
+0x00400004  addi $t0, $zero, 16
+0x00400008  add $s0, $zero, $zero
+0x0040000c  beq $t0, $zero, 24
+0x00400010  lw $t2, 0($t1)
+0x00400014  add $s0, $s0, $t2
+0x00400018  addi $t1, $t1, 4
+0x0040001c  addi $t0, $t0, -1
+0x00400020  j 0x0040000c
+0x00400024  jal 0x00400100
+0x00400028  addi $v0, $zero, 10
+0x0040002c  syscall
+#
+# double the array into 0x10010100
+0x00400100  lui $t1, 0x1001
+0x00400104  addi $t3, $t1, 256
+0x00400108  addi $t0, $zero, 16
+0x0040010c  beq $t0, $zero, 32
+0x00400110  lw $t2, 0($t1)
+0x00400114  add $t2, $t2, $t2
+0x00400118  sw $t2, 0($t3)
+0x0040011c  addi $t1, $t1, 4
+0x00400120  addi $t3, $t3, 4
+0x00400124  addi $t0, $t0, -1
+0x00400128  j 0x0040010c
+0x0040012c  jr $ra
+#
+0x10010000  .word 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
@@ -0,0 +1,367 @@
+/***********************************************************************/
+/***********************************************************************
+ Throughput benchmarks for the pipeline/cache simulator.
+
+ The simulator is one translation unit with all state global, so it is
+ pulled in whole here with its main() renamed.  Every result is one CSV
+ line on stdout:
+
+    benchmark,config,ops,seconds,ns_per_op,ops_per_sec
+
+ Anything the simulator itself prints while a benchmark runs goes to
+ /dev/null.  make bench builds and runs this file.
+ ***********************************************************************/
+/***********************************************************************/
+
+#include <time.h>
+
+#define main iplc_sim_main
+#include "iplc-sim.c"
+#undef main
+
+#define BENCH_MIN_SECONDS 0.5
+#define SYNTHETIC_LINES 200000
+
+FILE *results;
+
+/* geometries every cache benchmark is run at: index, blocksize, assoc */
+int bench_geometry[][3] = {
+    {7, 1, 1},
+    {2, 2, 2},
+    {4, 2, 4},
+    {2, 1, 16},
+    {0, 1, 32},
+};
+#define BENCH_GEOMETRIES (int)(sizeof(bench_geometry) / sizeof(bench_geometry[0]))
+
+double bench_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bench_report(char *name, char *config, long ops, double seconds)
+{
+    fprintf(results, "%s,%s,%ld,%.6f,%.3f,%.0f\n", name, config, ops, seconds,
+            seconds * 1e9 / ops, ops / seconds);
+    fflush(results);
+}
+
+/*
+ * Small xorshift generator so address streams are the same on every run.
+ */
+unsigned int bench_seed = 2463534242u;
+
+unsigned int bench_random()
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+/*
+ * Word addresses drawn from a working set twice the size of the cache,
+ * giving a mix of hits and misses.
+ */
+unsigned int *bench_addresses(int count, unsigned int span)
+{
+    unsigned int *address = (unsigned int *)malloc(sizeof(unsigned int) * count);
+    int i;
+
+    for (i = 0; i < count; i++)
+        address[i] = 0x10010000 + ((bench_random() % span) & ~3u);
+    return address;
+}
+
+/************************************************************************************************/
+/* Trace Buffers ********************************************************************************/
+/************************************************************************************************/
+
+typedef struct trace_buffer
+{
+    char (*line)[80];
+    int count;
+} trace_buffer_t;
+
+void bench_load_trace(trace_buffer_t *trace, char *file_name)
+{
+    FILE *f = fopen(file_name, "r");
+    char buffer[80];
+    int size = 1024;
+
+    if (f == NULL) {
+        printf("fopen failed for %s file\n", file_name);
+        exit(-1);
+    }
+    trace->line = malloc(sizeof(*trace->line) * size);
+    trace->count = 0;
+    while (fgets(buffer, 80, f) != NULL) {
+        if (trace->count == size) {
+            size *= 2;
+            trace->line = realloc(trace->line, sizeof(*trace->line) * size);
+        }
+        strcpy(trace->line[trace->count++], buffer);
+    }
+    fclose(f);
+}
+
+/*
+ * A loop that walks an array with loads and stores, calls a leaf function
+ * every iteration and branches back, in the same text format as the sample
+ * trace.  Code and data both outgrow small caches.
+ */
+void bench_synthetic_trace(trace_buffer_t *trace, int count)
+{
+    unsigned int pc = 0x00400000, element = 0;
+    int i = 0;
+
+    trace->line = malloc(sizeof(*trace->line) * count);
+
+    while (i + 8 <= count) {
+        unsigned int body = 0x00400100 + (element % 64) * 0x40;
+
+        pc = body;
+        sprintf(trace->line[i++], "0x%08x  lw $8, 0($9): %08x\n", pc, 0x10010000 + (element * 4) % 0x8000);
+        pc += 4;
+        sprintf(trace->line[i++], "0x%08x  add $10, $8, $11\n", pc);
+        pc += 4;
+        sprintf(trace->line[i++], "0x%08x  addi $9, $9, 4\n", pc);
+        pc += 4;
+        sprintf(trace->line[i++], "0x%08x  sw $10, 0($9): %08x\n", pc, 0x10018000 + (element * 4) % 0x8000);
+        pc += 4;
+        sprintf(trace->line[i++], "0x%08x  jal 0x00400040\n", pc);
+        sprintf(trace->line[i++], "0x00400040  addu $2, $4, $5\n");
+        sprintf(trace->line[i++], "0x00400044  jr $31\n");
+        pc += 4;
+        sprintf(trace->line[i++], "0x%08x  beq $9, $12, 16\n", pc);
+        element++;
+    }
+    trace->count = i;
+}
+
+/************************************************************************************************/
+/* Benchmarks ***********************************************************************************/
+/************************************************************************************************/
+
+void bench_geometry_name(char *config, int g)
+{
+    sprintf(config, "%d-%d-%d", bench_geometry[g][0], bench_geometry[g][1], bench_geometry[g][2]);
+}
+
+void bench_trap_address()
+{
+    int g, i, count = 1 << 16;
+    char config[32];
+
+    for (g = 0; g < BENCH_GEOMETRIES; g++) {
+        unsigned int span = 8 * bench_geometry[g][1] * bench_geometry[g][2] << bench_geometry[g][0];
+        unsigned int *address = bench_addresses(count, span);
+        long ops = 0;
+        double start, elapsed;
+
+        iplc_sim_init(bench_geometry[g][0], bench_geometry[g][1], bench_geometry[g][2]);
+        start = bench_now();
+        do {
+            for (i = 0; i < count; i++)
+                iplc_sim_trap_address(address[i]);
+            ops += count;
+        } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+
+        bench_geometry_name(config, g);
+        bench_report("trap_address", config, ops, elapsed);
+        free(address);
+    }
+}
+
+/*
+ * Both LRU routines on one fully used set, touching the ways in a rotating
+ * order so every position of the replacement list gets moved.
+ */
+void bench_lru()
+{
+    int g, i, count = 1 << 16;
+    char config[32];
+
+    for (g = 0; g < BENCH_GEOMETRIES; g++) {
+        int sets = 1 << bench_geometry[g][0], assoc = bench_geometry[g][2];
+        long ops = 0;
+        double start, elapsed;
+
+        iplc_sim_init(bench_geometry[g][0], bench_geometry[g][1], assoc);
+        bench_geometry_name(config, g);
+
+        start = bench_now();
+        do {
+            for (i = 0; i < count; i++)
+                iplc_sim_LRU_update_on_hit(i & (sets - 1), (i >> 3) % assoc);
+            ops += count;
+        } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+        bench_report("LRU_update_on_hit", config, ops, elapsed);
+
+        ops = 0;
+        start = bench_now();
+        do {
+            for (i = 0; i < count; i++)
+                iplc_sim_LRU_replace_on_miss(i & (sets - 1), i);
+            ops += count;
+        } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+        bench_report("LRU_replace_on_miss", config, ops, elapsed);
+    }
+}
+
+/*
+ * One stage push per call, fed with NOPs at sequential addresses so the
+ * instruction fetch goes through the cache as it would in a real run.
+ */
+void bench_push_pipeline()
+{
+    int i, count = 1 << 16;
+    long ops = 0;
+    double start, elapsed;
+
+    iplc_sim_init(2, 2, 2);
+    start = bench_now();
+    do {
+        for (i = 0; i < count; i++) {
+            instruction_address = 0x00400000 + (i & 0xfff) * 4;
+            iplc_sim_process_pipeline_nop();
+        }
+        ops += count;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+    bench_report("push_pipeline_stage", "2-2-2", ops, elapsed);
+}
+
+void bench_parse_instruction(trace_buffer_t *trace, char *name)
+{
+    char buffer[80];
+    long ops = 0;
+    int i;
+    double start, elapsed;
+
+    iplc_sim_init(2, 2, 2);
+    start = bench_now();
+    do {
+        for (i = 0; i < trace->count; i++) {
+            strcpy(buffer, trace->line[i]);  // the parser writes into its argument
+            iplc_sim_parse_instruction(buffer);
+        }
+        ops += trace->count;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+    bench_report("parse_instruction", name, ops, elapsed);
+}
+
+/*
+ * Whole runs from a cold cache, including the final drain, reported as
+ * trace lines per second.
+ */
+void bench_end_to_end(trace_buffer_t *trace, char *name)
+{
+    char buffer[80], config[96];
+    int g, i;
+
+    for (g = 0; g < BENCH_GEOMETRIES; g++) {
+        long ops = 0;
+        double start, elapsed;
+
+        start = bench_now();
+        do {
+            iplc_sim_init(bench_geometry[g][0], bench_geometry[g][1], bench_geometry[g][2]);
+            iplc_sim_reset();
+            for (i = 0; i < trace->count; i++) {
+                strcpy(buffer, trace->line[i]);
+                iplc_sim_parse_instruction(buffer);
+            }
+            iplc_sim_finalize();
+            ops += trace->count;
+        } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+
+        sprintf(config, "%s/", name);
+        bench_geometry_name(config + strlen(config), g);
+        bench_report("end_to_end", config, ops, elapsed);
+    }
+}
+
+/*
+ * Reading and decoding every line, from the text trace with fgets() and
+ * sscanf() and from the same trace compressed, without simulating.
+ */
+void bench_read(trace_buffer_t *trace, char *name)
+{
+    char text_name[] = "/tmp/iplc-bench-XXXXXX", compressed_name[] = "/tmp/iplc-bench-XXXXXX";
+    char buffer[80];
+    decoded_instruction_t decoded;
+    FILE *f;
+    long ops = 0;
+    int i;
+    double start, elapsed;
+
+    close(mkstemp(text_name));
+    close(mkstemp(compressed_name));
+    f = fopen(text_name, "w+");
+    for (i = 0; i < trace->count; i++)
+        fputs(trace->line[i], f);
+    iplc_sim_ztrace_write(f, compressed_name);
+
+    start = bench_now();
+    do {
+        rewind(f);
+        while (fgets(buffer, 80, f) != NULL)
+            iplc_sim_decode_instruction(buffer, &decoded);
+        ops += trace->count;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+    bench_report("read_text", name, ops, elapsed);
+
+    iplc_sim_ztrace_open(compressed_name);
+    ops = 0;
+    start = bench_now();
+    do {
+        iplc_sim_ztrace_seek(0);
+        while (iplc_sim_ztrace_next(&decoded))
+            ;
+        ops += trace->count;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+    bench_report("read_compressed", name, ops, elapsed);
+
+    fclose(f);
+    unlink(text_name);
+    unlink(compressed_name);
+}
+
+/************************************************************************************************/
+/* MAIN *****************************************************************************************/
+/************************************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    trace_buffer_t sample, synthetic;
+    char *trace_file_name = argc > 1 ? argv[1] : "instruction-trace.txt";
+
+    // keep the real stdout for results and silence the simulator
+    results = fdopen(dup(fileno(stdout)), "w");
+    if (results == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Cannot redirect simulator output \n");
+        exit(-1);
+    }
+    trace_output = 0;
+    dump_pipeline = 0;
+    branch_predict_taken = 1;
+
+    bench_load_trace(&sample, trace_file_name);
+    bench_synthetic_trace(&synthetic, SYNTHETIC_LINES);
+
+    fprintf(results, "benchmark,config,ops,seconds,ns_per_op,ops_per_sec\n");
+    bench_trap_address();
+    bench_lru();
+    bench_push_pipeline();
+    bench_parse_instruction(&sample, "sample");
+    bench_parse_instruction(&synthetic, "synthetic");
+    bench_end_to_end(&sample, "sample");
+    bench_end_to_end(&synthetic, "synthetic");
+    bench_read(&sample, "sample");
+    bench_read(&synthetic, "synthetic");
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+/***********************************************************************/
+/***********************************************************************
+ Streaming comparison of a simulator run against a golden output.
+
+ Usage: iplc-check golden [actual]
+
+ Reads both outputs a line at a time (the actual run from stdin when no
+ file is given, gzip'ed goldens through gzip -dc), so neither side is ever
+ held in memory.  On the first line that differs it reports the cycle and
+ fetch address the golden run was at, both lines, and exits 1.
+ ***********************************************************************/
+/***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE 1024
+
+/*
+ * Open a golden, decompressing on the fly when it ends in .gz.
+ */
+FILE *check_open(char *name, int *piped)
+{
+    char command[2048];
+    int len = strlen(name);
+
+    *piped = 0;
+    if (strcmp(name, "-") == 0)
+        return stdin;
+    if (len > 3 && strcmp(name + len - 3, ".gz") == 0) {
+        snprintf(command, sizeof(command), "gzip -dc '%s'", name);
+        *piped = 1;
+        return popen(command, "r");
+    }
+    return fopen(name, "r");
+}
+
+/*
+ * Follow where the run is from the golden's event stream: pipeline dumps
+ * carry the cycle, cache lines carry the address being fetched.
+ */
+void check_track(char *line, unsigned int *cycle, unsigned int *pc, int *in_stats)
+{
+    char *p;
+
+    if (sscanf(line, "(cyc: %u)", cycle) == 1)
+        return;
+    if (strncmp(line, "INST ", 5) == 0 && (p = strstr(line, "Address 0x")) != NULL)
+        sscanf(p + 10, "%x", pc);
+    else if (strncmp(line, " Cache Performance", 18) == 0)
+        *in_stats = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *golden, *actual;
+    int golden_piped, actual_piped;
+    char expect[MAX_LINE], got[MAX_LINE];
+    char *e, *g;
+    unsigned long line = 0;
+    unsigned int cycle = 0, pc = 0;
+    int in_stats = 0;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s golden [actual] \n", argv[0]);
+        exit(2);
+    }
+    golden = check_open(argv[1], &golden_piped);
+    actual = check_open(argc == 3 ? argv[2] : "-", &actual_piped);
+    if (golden == NULL || actual == NULL) {
+        fprintf(stderr, "Cannot open %s \n", golden == NULL ? argv[1] : argv[2]);
+        exit(2);
+    }
+
+    for (;;) {
+        e = fgets(expect, MAX_LINE, golden);
+        g = fgets(got, MAX_LINE, actual);
+        line++;
+
+        if (e == NULL && g == NULL)
+            break;
+        if (e != NULL && g != NULL && strcmp(expect, got) == 0) {
+            check_track(expect, &cycle, &pc, &in_stats);
+            continue;
+        }
+
+        if (in_stats)
+            printf("\t final statistics differ at line %lu \n", line);
+        else
+            printf("\t first divergence at line %lu, after cycle %u, fetch address 0x%x \n",
+                   line, cycle, pc);
+        printf("\t expected: %s", e ? expect : "<end of output>\n");
+        printf("\t      got: %s", g ? got : "<end of output>\n");
+        exit(1);
+    }
+
+    if (golden_piped)
+        pclose(golden);
+    if (actual_piped)
+        pclose(actual);
+    return 0;
+}
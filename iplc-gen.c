@@ -0,0 +1,555 @@
+/***********************************************************************/
+/***********************************************************************
+ Synthetic trace generator for the pipeline/cache simulator.
+
+ Builds a small program -- nested loops around a body of ALU ops, loads,
+ stores and data dependent branches, plus a chain of calls -- and walks
+ it, writing one line per executed instruction in the format
+ iplc_sim_parse_instruction() reads.  The program text is laid out once,
+ so the instruction stream has real code locality, and every load and
+ store slot has its own address stream over the working set.
+
+ The same options and seed always give the same trace.  Lines are built
+ into a large buffer without printf so the generator keeps up with the
+ disk.
+ ***********************************************************************/
+/***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#define TEXT_BASE 0x00400000
+#define DATA_BASE 0x10010000
+#define FUNCTION_ALIGN 0x100
+#define MAX_DEPTH 8
+#define MAX_BODY 256
+#define MAX_CODE 4096
+#define MAX_LINE 64
+#define CHASE_NODE 64
+#define OUTPUT_BUFFER (1 << 20)
+
+enum gen_kind {G_ALU, G_LOAD, G_STORE, G_BRANCH, G_LOOP, G_CALL, G_RETURN, G_JUMP};
+enum gen_pattern {P_SEQUENTIAL, P_STRIDE, P_RANDOM, P_CHASE};
+
+/* one static instruction of the generated program */
+typedef struct gen_instruction
+{
+    enum gen_kind kind;
+    char text[MAX_LINE];          // whole line, or everything before the data address
+    int length;
+    int target;                   // code index a taken branch, call or jump goes to
+    int loop;                     // loop level a latch closes
+    int stream;                   // address stream of a load or store
+} gen_instruction_t;
+
+/* options */
+unsigned long long lines = 1000000;
+unsigned long long seed = 1;
+int loop_depth = 2;
+unsigned long trips[MAX_DEPTH] = {100, 10, 10, 10, 10, 10, 10, 10};
+int body_length = 16;
+unsigned int working_set = 32768;
+enum gen_pattern pattern = P_SEQUENTIAL;
+unsigned int stride = 4;
+double branch_bias = 0.5;
+int call_depth = 1;
+int mix[4] = {50, 20, 10, 20};    // alu, load, store, branch weights
+
+gen_instruction_t code[MAX_CODE];
+int code_count = 0;
+
+unsigned int *stream_cursor = NULL;
+int stream_count = 0;
+unsigned int *chase_next = NULL;
+unsigned int chase_nodes = 0;
+unsigned int branch_threshold;
+
+char output[OUTPUT_BUFFER + MAX_LINE];
+int output_length = 0;
+FILE *output_file;
+
+static const char hex_digit[] = "0123456789abcdef";
+
+/************************************************************************************************/
+/* Random Numbers *******************************************************************************/
+/************************************************************************************************/
+
+/*
+ * xorshift64*, small and fast enough to draw per instruction.
+ */
+unsigned long long rng_state;
+
+static inline unsigned int gen_random()
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (unsigned int)((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+/************************************************************************************************/
+/* Program Layout *******************************************************************************/
+/************************************************************************************************/
+
+unsigned int gen_pc(int index)
+{
+    return TEXT_BASE + index * 4;
+}
+
+int gen_emit(enum gen_kind kind)
+{
+    if (code_count == MAX_CODE) {
+        fprintf(stderr, "Generated program too large \n");
+        exit(-1);
+    }
+    bzero(&code[code_count], sizeof(gen_instruction_t));
+    code[code_count].kind = kind;
+    code[code_count].target = -1;
+    code[code_count].loop = -1;
+    code[code_count].stream = -1;
+    return code_count++;
+}
+
+/*
+ * Pad with nops up to the next function boundary.
+ */
+void gen_align()
+{
+    while ((gen_pc(code_count) & (FUNCTION_ALIGN - 1)) != 0)
+        gen_emit(G_ALU);
+}
+
+/*
+ * One instruction from the mix: ALU ops rotate through the forms the
+ * simulator knows, loads write $8-$15 that later ALU ops read back.
+ */
+void gen_body_instruction()
+{
+    unsigned int pick = gen_random() % (mix[0] + mix[1] + mix[2] + mix[3]);
+    int i;
+
+    if (pick < mix[0])
+        i = gen_emit(G_ALU);
+    else if (pick < mix[0] + mix[1])
+        i = gen_emit(G_LOAD);
+    else if (pick < mix[0] + mix[1] + mix[2])
+        i = gen_emit(G_STORE);
+    else {
+        // skips the next instruction when taken
+        i = gen_emit(G_BRANCH);
+        code[i].target = i + 2;
+    }
+    if (code[i].kind == G_LOAD || code[i].kind == G_STORE)
+        code[i].stream = stream_count++;
+}
+
+void gen_body(int length)
+{
+    int i;
+
+    for (i = 0; i < length; i++)
+        gen_body_instruction();
+    // a branch must not skip past the end of the body
+    if (code[code_count - 1].kind == G_BRANCH)
+        gen_emit(G_ALU);
+}
+
+/*
+ * Lay out main -- nested loops with the calls in the innermost body --
+ * followed by the call chain, one aligned function per level.
+ */
+void gen_layout()
+{
+    int head[MAX_DEPTH];
+    int call[MAX_DEPTH + 1];
+    int level, i;
+
+    gen_emit(G_ALU);              // lui of the data base
+    gen_emit(G_ALU);              // ori of the data base
+    for (level = 0; level < loop_depth; level++) {
+        gen_emit(G_ALU);          // reset the counter
+        head[level] = code_count;
+    }
+    gen_body(body_length);
+    call[0] = call_depth ? gen_emit(G_CALL) : -1;
+    for (level = loop_depth - 1; level >= 0; level--) {
+        gen_emit(G_ALU);          // step the counter
+        i = gen_emit(G_LOOP);
+        code[i].target = head[level];
+        code[i].loop = level;
+    }
+    i = gen_emit(G_JUMP);
+    code[i].target = 0;
+
+    for (level = 1; level <= call_depth; level++) {
+        gen_align();
+        code[call[level - 1]].target = code_count;
+        gen_body(body_length / 4 + 1);
+        call[level] = level < call_depth ? gen_emit(G_CALL) : -1;
+        gen_emit(G_RETURN);
+    }
+}
+
+/*
+ * Render the fixed part of every line.  Register numbers cycle so there
+ * is a steady share of load-use pairs.
+ */
+void gen_render()
+{
+    int i, reg = 8;
+    unsigned int pc, target;
+
+    for (i = 0; i < code_count; i++) {
+        gen_instruction_t *in = &code[i];
+        pc = gen_pc(i);
+        target = in->target >= 0 ? gen_pc(in->target) : 0;
+
+        switch (in->kind) {
+            case G_ALU:
+                switch (i % 5) {
+                    case 0:
+                        sprintf(in->text, "0x%08x  add $%d, $%d, $%d\n", pc, reg, 8 + (reg + 7) % 8, 16 + i % 8);
+                        break;
+                    case 1:
+                        sprintf(in->text, "0x%08x  addi $%d, $%d, %d\n", pc, 16 + i % 8, 16 + i % 8, 4);
+                        break;
+                    case 2:
+                        sprintf(in->text, "0x%08x  addu $%d, $%d, $%d\n", pc, 16 + i % 8, reg, 16 + (i + 1) % 8);
+                        break;
+                    case 3:
+                        sprintf(in->text, "0x%08x  ori $%d, $%d, %d\n", pc, 16 + i % 8, 16 + i % 8, 255);
+                        break;
+                    default:
+                        sprintf(in->text, "0x%08x  sll $%d, $%d, %d\n", pc, 16 + i % 8, reg, 2);
+                        break;
+                }
+                break;
+            case G_LOAD:
+                reg = 8 + (reg - 7) % 8;
+                sprintf(in->text, "0x%08x  lw $%d, 0($%d): ", pc, reg, 16 + i % 8);
+                break;
+            case G_STORE:
+                sprintf(in->text, "0x%08x  sw $%d, 0($%d): ", pc, reg, 16 + i % 8);
+                break;
+            case G_BRANCH:
+            case G_LOOP:
+                sprintf(in->text, "0x%08x  beq $%d, $%d, %d\n", pc, 16 + i % 8, 8 + i % 8,
+                        (int)(target - pc));
+                break;
+            case G_CALL:
+                sprintf(in->text, "0x%08x  jal 0x%08x\n", pc, target);
+                break;
+            case G_RETURN:
+                sprintf(in->text, "0x%08x  jr $31\n", pc);
+                break;
+            case G_JUMP:
+                sprintf(in->text, "0x%08x  j 0x%08x\n", pc, target);
+                break;
+        }
+        in->length = strlen(in->text);
+    }
+}
+
+/************************************************************************************************/
+/* Address Streams ******************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Streams start spread over the working set.  Pointer chasing walks one
+ * random cycle through every CHASE_NODE bytes of it (Sattolo's shuffle).
+ */
+void gen_streams_init()
+{
+    unsigned int i, j, t;
+
+    stream_cursor = (unsigned int *)calloc(stream_count + 1, sizeof(unsigned int));
+    for (i = 0; i < stream_count; i++)
+        stream_cursor[i] = (unsigned int)((unsigned long long)working_set * i / (stream_count ? stream_count : 1)) & ~3u;
+
+    if (pattern == P_CHASE) {
+        chase_nodes = working_set / CHASE_NODE;
+        if (chase_nodes < 2) {
+            fprintf(stderr, "Working set too small for pointer chasing \n");
+            exit(-1);
+        }
+        chase_next = (unsigned int *)malloc(sizeof(unsigned int) * chase_nodes);
+        for (i = 0; i < chase_nodes; i++)
+            chase_next[i] = i;
+        for (i = chase_nodes - 1; i > 0; i--) {
+            j = gen_random() % i;
+            t = chase_next[i];
+            chase_next[i] = chase_next[j];
+            chase_next[j] = t;
+        }
+        for (i = 0; i < stream_count; i++)
+            stream_cursor[i] = (stream_cursor[i] / CHASE_NODE) % chase_nodes;
+    }
+}
+
+static inline unsigned int gen_next_address(int stream)
+{
+    unsigned int offset = stream_cursor[stream];
+
+    switch (pattern) {
+        case P_SEQUENTIAL:
+        case P_STRIDE:
+            stream_cursor[stream] = offset + stride < working_set ? offset + stride : 0;
+            break;
+        case P_RANDOM:
+            offset = (gen_random() % working_set) & ~3u;
+            break;
+        case P_CHASE:
+            stream_cursor[stream] = chase_next[offset];
+            offset *= CHASE_NODE;
+            break;
+    }
+    return DATA_BASE + offset;
+}
+
+/************************************************************************************************/
+/* Output ***************************************************************************************/
+/************************************************************************************************/
+
+static inline void gen_flush()
+{
+    if (fwrite(output, 1, output_length, output_file) != output_length) {
+        perror("write");
+        exit(-1);
+    }
+    output_length = 0;
+}
+
+static inline void gen_put_hex(unsigned int value)
+{
+    char *p = output + output_length;
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        p[i] = hex_digit[value & 0xf];
+        value >>= 4;
+    }
+    p[8] = '\n';
+    output_length += 9;
+}
+
+/*
+ * Execute the program for the requested number of lines.
+ */
+void gen_run()
+{
+    unsigned long counter[MAX_DEPTH];
+    int stack[MAX_DEPTH + 1];
+    int sp = 0, pc = 0, level;
+    unsigned long long n;
+
+    for (level = 0; level < MAX_DEPTH; level++)
+        counter[level] = 0;
+
+    for (n = 0; n < lines; n++) {
+        gen_instruction_t *in = &code[pc];
+
+        memcpy(output + output_length, in->text, in->length);
+        output_length += in->length;
+
+        switch (in->kind) {
+            case G_LOAD:
+            case G_STORE:
+                gen_put_hex(gen_next_address(in->stream));
+                pc++;
+                break;
+            case G_BRANCH:
+                pc = gen_random() < branch_threshold ? in->target : pc + 1;
+                break;
+            case G_LOOP:
+                if (++counter[in->loop] < trips[in->loop])
+                    pc = in->target;
+                else {
+                    counter[in->loop] = 0;
+                    pc++;
+                }
+                break;
+            case G_CALL:
+                stack[sp++] = pc + 1;
+                pc = in->target;
+                break;
+            case G_RETURN:
+                pc = stack[--sp];
+                break;
+            case G_JUMP:
+                pc = in->target;
+                break;
+            default:
+                pc++;
+                break;
+        }
+
+        if (output_length >= OUTPUT_BUFFER)
+            gen_flush();
+    }
+    gen_flush();
+}
+
+/************************************************************************************************/
+/* Option Parsing *******************************************************************************/
+/************************************************************************************************/
+
+void gen_parse_pattern(char *spec)
+{
+    if (strcmp(spec, "seq") == 0) {
+        pattern = P_SEQUENTIAL;
+        stride = 4;
+    }
+    else if (sscanf(spec, "stride=%u", &stride) == 1 && stride > 0 && stride % 4 == 0)
+        pattern = P_STRIDE;
+    else if (strcmp(spec, "random") == 0)
+        pattern = P_RANDOM;
+    else if (strcmp(spec, "chase") == 0)
+        pattern = P_CHASE;
+    else {
+        fprintf(stderr, "Unknown pattern: %s \n", spec);
+        exit(-1);
+    }
+}
+
+/*
+ * "100,10" gives the trip count of each level, outermost first; the last
+ * one given repeats for deeper levels.
+ */
+void gen_parse_trips(char *spec)
+{
+    char *opt;
+    int level = 0;
+
+    for (opt = strtok(spec, ","); opt != NULL && level < MAX_DEPTH; opt = strtok(NULL, ","))
+        trips[level++] = strtoul(opt, NULL, 10);
+    for (; level < MAX_DEPTH && level > 0; level++)
+        trips[level] = trips[level - 1];
+}
+
+void gen_parse_mix(char *spec)
+{
+    char *opt;
+    char key[32];
+    int value;
+
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (sscanf(opt, "%31[^=]=%d", key, &value) != 2 || value < 0) {
+            fprintf(stderr, "Bad mix option: %s \n", opt);
+            exit(-1);
+        }
+        if (strcmp(key, "alu") == 0)
+            mix[0] = value;
+        else if (strcmp(key, "load") == 0)
+            mix[1] = value;
+        else if (strcmp(key, "store") == 0)
+            mix[2] = value;
+        else if (strcmp(key, "branch") == 0)
+            mix[3] = value;
+        else {
+            fprintf(stderr, "Unknown mix class: %s \n", key);
+            exit(-1);
+        }
+    }
+    if (mix[0] + mix[1] + mix[2] + mix[3] == 0) {
+        fprintf(stderr, "Instruction mix is empty \n");
+        exit(-1);
+    }
+}
+
+void gen_usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-n lines] [-s seed] [-l loop-depth] [-t trips] [-b body] \n"
+                    "       [-w working-set] [-p pattern] [-B branch-bias] [-c call-depth] \n"
+                    "       [-m mix] [-o file] \n", name);
+    fprintf(stderr, "\t -n   lines to write (default 1000000) \n");
+    fprintf(stderr, "\t -s   random seed (default 1) \n");
+    fprintf(stderr, "\t -l   loop nesting depth, 1-%d (default 2) \n", MAX_DEPTH);
+    fprintf(stderr, "\t -t   trip counts, outermost first, e.g. 100,10 \n");
+    fprintf(stderr, "\t -b   instructions in the innermost body, 1-%d (default 16) \n", MAX_BODY);
+    fprintf(stderr, "\t -w   data working set in bytes (default 32768) \n");
+    fprintf(stderr, "\t -p   seq, stride=N, random or chase \n");
+    fprintf(stderr, "\t -B   chance a data dependent branch is taken (default 0.5) \n");
+    fprintf(stderr, "\t -c   call chain depth, 0-%d (default 1) \n", MAX_DEPTH);
+    fprintf(stderr, "\t -m   instruction mix weights, e.g. alu=50,load=20,store=10,branch=20 \n");
+    fprintf(stderr, "\t -o   output file (default stdout) \n");
+    exit(-1);
+}
+
+/************************************************************************************************/
+/* MAIN *****************************************************************************************/
+/************************************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    char *output_name = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:l:t:b:w:p:B:c:m:o:")) != -1) {
+        switch (opt) {
+            case 'n':
+                lines = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'l':
+                loop_depth = atoi(optarg);
+                break;
+            case 't':
+                gen_parse_trips(optarg);
+                break;
+            case 'b':
+                body_length = atoi(optarg);
+                break;
+            case 'w':
+                working_set = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                gen_parse_pattern(optarg);
+                break;
+            case 'B':
+                branch_bias = atof(optarg);
+                break;
+            case 'c':
+                call_depth = atoi(optarg);
+                break;
+            case 'm':
+                gen_parse_mix(optarg);
+                break;
+            case 'o':
+                output_name = optarg;
+                break;
+            default:
+                gen_usage(argv[0]);
+        }
+    }
+
+    if (loop_depth < 1 || loop_depth > MAX_DEPTH || body_length < 1 || body_length > MAX_BODY ||
+        call_depth < 0 || call_depth > MAX_DEPTH || working_set < 4 ||
+        branch_bias < 0.0 || branch_bias > 1.0)
+        gen_usage(argv[0]);
+    for (opt = 0; opt < loop_depth; opt++) {
+        if (trips[opt] < 1)
+            gen_usage(argv[0]);
+    }
+
+    output_file = stdout;
+    if (output_name && (output_file = fopen(output_name, "w")) == NULL) {
+        fprintf(stderr, "fopen failed for %s file\n", output_name);
+        exit(-1);
+    }
+
+    rng_state = seed * 0x9e3779b97f4a7c15ULL + 1;
+    branch_threshold = branch_bias >= 1.0 ? 0xffffffff : (unsigned int)(branch_bias * 4294967296.0);
+
+    gen_layout();
+    gen_render();
+    gen_streams_init();
+    gen_run();
+
+    if (output_file != stdout)
+        fclose(output_file);
+    return 0;
+}
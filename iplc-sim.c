@@ -8,23 +8,99 @@
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #define MAX_CACHE_SIZE 10240
 #define CACHE_MISS_DELAY 10 // 10 cycle cache miss penalty
+#define VICTIM_HIT_DELAY 1  // 1 cycle to swap a line back from the victim cache
+#define MAX_VICTIM_ENTRIES 16
+#define MAX_DRAM_QUEUE 64
+#define CHECKPOINT_MAGIC "IPLCCKP1"
+#define PHASE_DIMS 16  // basic block vectors are projected down to this many dimensions
+#define MAX_CHUNKS 256
+#define MAX_LANES 16
+#define MAX_LANE_WAYS 64
 #define MAX_STAGES 5
+#define MAX_LOOP_LINES 256
+#define REUSE_BINS 34  // log2 bins of reuse distance, bin 0 is distance 0
+#define PROFILE_EVENTS 4
+#define PROFILE_DEPTH 8
+#define MAX_SERVER_TRACES 32
+#define MAX_CORES 16
+#define ZTRACE_MAGIC "IPLCZTR1"
+#define ZTRACE_BLOCK_LINES 4096   // lines per independently decodable block
+
+/* One trace line after parsing, so a trace can be decoded once and replayed */
+enum instruction_type {NOP, RTYPE, LW, SW, BRANCH, JUMP, JAL, SYSCALL};
+
+typedef struct decoded_instruction
+{
+    enum instruction_type itype;
+    unsigned int instruction_address;
+    unsigned int data_address;
+    int dest_reg;                 // the source register for a store
+    int reg1;
+    int reg2;
+    char instruction[16];
+} decoded_instruction_t;
 
 // init the simulator
 void iplc_sim_init(int index, int blocksize, int assoc);
+void iplc_sim_reset();
+unsigned long iplc_sim_cache_size(int index, int blocksize, int assoc);
+void iplc_sim_build_cache(int index, int assoc);
 
 // Cache simulator functions
 void iplc_sim_LRU_replace_on_miss(int index, int tag);
 void iplc_sim_LRU_update_on_hit(int index, int assoc);
 int iplc_sim_trap_address(unsigned int address);
+void iplc_sim_select_kernels(int assoc);
+
+// Victim cache functions
+void iplc_sim_victim_init();
+int iplc_sim_victim_probe(unsigned int block);
+void iplc_sim_victim_insert(unsigned int block);
+
+// DRAM functions
+void iplc_sim_dram_configure(char *spec);
+void iplc_sim_dram_init();
+unsigned int iplc_sim_dram_access(unsigned int address, unsigned long now);
+void iplc_sim_dram_report();
+
+// TLB functions
+void iplc_sim_tlb_configure(char *spec);
+void iplc_sim_tlb_init();
+unsigned int iplc_sim_tlb_translate(unsigned int address, int is_data);
+void iplc_sim_tlb_report();
+
+// Miss classification functions
+void iplc_sim_classify_init();
+void iplc_sim_classify_access(unsigned int address, int hit);
+
+// Reuse distance functions
+void iplc_sim_reuse_init();
+void iplc_sim_reuse_access(unsigned int address, int is_data);
+void iplc_sim_reuse_report();
 
 // Pipeline functions
 unsigned int iplc_sim_parse_reg(char *reg_str);
 void iplc_sim_parse_instruction(char *buffer);
+void iplc_sim_decode_instruction(char *buffer, decoded_instruction_t *decoded);
+void iplc_sim_execute_instruction(decoded_instruction_t *decoded);
 void iplc_sim_push_pipeline_stage();
+void iplc_sim_drain_pipeline();
 void iplc_sim_process_pipeline_rtype(char *instruction, int dest_reg,
                                      int reg1, int reg2_or_constant);
 void iplc_sim_process_pipeline_lw(int dest_reg, int base_reg, unsigned int data_address);
@@ -34,9 +110,111 @@ void iplc_sim_process_pipeline_jump();
 void iplc_sim_process_pipeline_syscall();
 void iplc_sim_process_pipeline_nop();
 
+// Basic block functions
+int iplc_sim_block_eligible(decoded_instruction_t *decoded);
+void iplc_sim_block_track(decoded_instruction_t *decoded, int instruction_hit);
+void iplc_sim_block_queue(decoded_instruction_t *decoded);
+void iplc_sim_block_flush();
+
+// Loop functions
+void iplc_sim_loop_start(unsigned int head);
+int iplc_sim_loop_steady();
+void iplc_sim_loop_simulate(char *buffer);
+int iplc_sim_loop_extrapolate(char *buffer, FILE *trace_file);
+void iplc_sim_loop_step(char *buffer, FILE *trace_file);
+
+// Trigger functions
+void iplc_sim_trigger_configure(char *spec);
+void iplc_sim_trigger_event(int event, unsigned int address);
+void iplc_sim_trigger_miss(unsigned int address);
+void iplc_sim_trigger_line();
+
+// Timeline functions
+void iplc_sim_timeline_open(char *file_name);
+void iplc_sim_timeline_push();
+void iplc_sim_timeline_stall(char *cause, unsigned int start, unsigned int cycles,
+                             unsigned int pc, unsigned int address);
+void iplc_sim_timeline_close();
+
+// Functional front-end functions
+void iplc_sim_func_configure(char *spec);
+int iplc_sim_func_reg(char *str);
+void iplc_sim_func_load();
+void iplc_sim_func_run();
+
+// Compressed trace functions
+void iplc_sim_ztrace_write(FILE *trace_file, char *file_name);
+int iplc_sim_ztrace_open(char *file_name);
+void iplc_sim_ztrace_seek(long line);
+int iplc_sim_ztrace_next(decoded_instruction_t *decoded);
+void iplc_sim_ztrace_run();
+
+// Sampling functions
+void iplc_sim_sample_configure(char *spec);
+void iplc_sim_warm_instruction(char *buffer);
+void iplc_sim_sample_run(FILE *trace_file);
+
+// Phase functions
+void iplc_sim_phase_configure(char *spec);
+void iplc_sim_phase_run(FILE *trace_file);
+
+// Parallel functions
+void iplc_sim_parallel_configure(char *spec);
+void iplc_sim_parallel_run(FILE *trace_file, char *trace_file_name);
+
+// Multi-configuration functions
+void iplc_sim_multi_configure(char *spec);
+void iplc_sim_multi_run(FILE *trace_file);
+
+// Exploration functions
+void iplc_sim_explore_configure(char *spec);
+void iplc_sim_explore_run(FILE *trace_file);
+
+// Checkpoint functions
+void iplc_sim_checkpoint_save(char *file_name, char *trace_file_name, long trace_offset);
+FILE *iplc_sim_checkpoint_restore(char *file_name, char *trace_file_name);
+
+// Results functions
+void iplc_sim_results_configure(char *spec);
+double iplc_sim_wall_time();
+void iplc_sim_results_write();
+void iplc_sim_results_record(FILE *fp);
+
+// Profiling functions
+void iplc_sim_profile_init();
+void iplc_sim_profile_read(unsigned long long *value);
+void iplc_sim_profile_enter(int phase);
+void iplc_sim_profile_exit();
+char *iplc_sim_read_line(char *buffer, FILE *trace_file);
+void iplc_sim_profile_report();
+
+// Multicore functions
+void iplc_sim_mc_configure(char *spec);
+unsigned int iplc_sim_mc_miss(int index, int tag, int is_write);
+void iplc_sim_mc_hit(int index, int way, int is_write);
+void iplc_sim_mc_run(FILE *trace_file);
+
+// Server functions
+void iplc_sim_server_configure(char *spec);
+void iplc_sim_server_run();
+
 // Outout performance results
 void iplc_sim_finalize();
 
+/* The counters every run produces, for shipping results between processes */
+typedef struct sim_counters
+{
+    long cache_access;
+    long cache_miss;
+    long cache_hit;
+    unsigned int pipeline_cycles;
+    unsigned int instruction_count;
+    unsigned int branch_count;
+    unsigned int correct_branch_predictions;
+} sim_counters_t;
+
+void iplc_sim_get_counters(sim_counters_t *counters);
+
 typedef struct associativity
 {
     int vb; /* valid bit */
@@ -49,7 +227,62 @@ typedef struct cache_line
     int     *replacement;
 } cache_line_t;
 
+/* Victim cache entry, holds a whole block evicted from the main cache */
+typedef struct victim_line
+{
+    int vb;
+    unsigned int block;
+    long age;           /* insertion time, smallest is replaced first */
+} victim_line_t;
+
+typedef struct dram_bank
+{
+    int open_row;       /* -1 when the bank is precharged */
+    unsigned long ready;/* cycle its last scheduled request completes */
+} dram_bank_t;
+
+/* Request in the memory controller queue, scheduled but not yet complete */
+typedef struct dram_request
+{
+    int bank;
+    int row;
+    int prev_row;       /* row open in the bank just before this request */
+    unsigned long start;
+    unsigned long done;
+} dram_request_t;
+
+/*
+ * Open addressing hash map from block number to a non-negative value,
+ * used wherever we need O(1) lookups keyed by block address.
+ */
+typedef struct block_map
+{
+    unsigned int *key;
+    long         *val;  /* -1 marks an empty slot */
+    unsigned int mask;
+    unsigned int count;
+} block_map_t;
+
+/* Entry of the fully associative shadow cache, threaded on an LRU list */
+typedef struct shadow_line
+{
+    unsigned int block;
+    int prev;           /* towards MRU, -1 at the head */
+    int next;           /* towards LRU, -1 at the tail */
+} shadow_line_t;
+
 cache_line_t *cache=NULL;
+
+// lookup and LRU kernels for the current associativity, see iplc_sim_select_kernels()
+int (*iplc_sim_cache_lookup)(int index, int tag);
+void (*iplc_sim_cache_update)(int index, int assoc);
+void (*iplc_sim_cache_replace)(int index, int tag);
+
+int fast_valid=0;                 // the last block accessed, still the MRU line of its set
+unsigned int fast_block=0;
+int fast_index=0;
+int fast_way=0;
+long fast_hits=0;
 int cache_index=0;
 int cache_blocksize=0;
 int cache_blockoffsetbits = 0;
@@ -58,6 +291,84 @@ long cache_miss=0;
 long cache_access=0;
 long cache_hit=0;
 
+int victim_entries=0;             // victim cache size, 0 disables it (-v)
+victim_line_t *victim=NULL;
+long victim_clock=0;
+long victim_hit=0;
+
+unsigned int miss_delay=CACHE_MISS_DELAY; // penalty of the last miss
+
+int dram_enabled=0;               // DRAM timing instead of a flat penalty (-M)
+int dram_banks=8;
+int dram_row_bytes=2048;
+int dram_row_hit=4;               // column access only
+int dram_row_miss=8;              // activate + column access
+int dram_row_conflict=12;         // precharge + activate + column access
+int dram_bus_bytes=4;             // data bus bytes per cycle
+int dram_queue_depth=16;
+int dram_frfcfs=1;
+dram_bank_t *dram_bank=NULL;
+dram_request_t dram_queue[MAX_DRAM_QUEUE];
+int dram_queued=0;
+unsigned long dram_bus_ready=0;
+long dram_requests=0;
+long dram_row_hits=0;
+long dram_row_misses=0;
+long dram_row_conflicts=0;
+long dram_bypasses=0;
+long dram_queue_full=0;
+long dram_latency=0;
+unsigned long dram_wait=0;        // cycles the last request waited for a queue slot
+
+/* One level of TLB, sets of ways holding virtual page numbers */
+typedef struct tlb
+{
+    int sets;
+    int ways;
+    unsigned int *vpn;            // stored plus one, 0 is an empty way
+    unsigned long *stamp;         // last use, for LRU
+    long access;
+    long miss;
+} tlb_t;
+
+enum tlb_map {TLB_MAP_SEQ, TLB_MAP_HASH, TLB_MAP_IDENTITY};
+int tlb_enabled=0;                // translate trace addresses through TLBs (-V)
+tlb_t itlb = {1, 16, NULL, NULL, 0, 0};
+tlb_t dtlb = {1, 32, NULL, NULL, 0, 0};
+tlb_t l2tlb = {128, 4, NULL, NULL, 0, 0};
+int tlb_page_bytes=4096;
+int tlb_page_bits=12;
+int tlb_l1_delay=1;               // only paid by PIPT caches
+int tlb_l2_delay=6;
+int tlb_walk_delay=30;
+int tlb_pipt=0;
+enum tlb_map tlb_map=TLB_MAP_SEQ;
+unsigned long tlb_clock=0;
+long tlb_walks=0;
+long tlb_cycles=0;
+
+int classify_misses=0;            // 3C miss classification (-c)
+long cache_miss_compulsory=0;
+long cache_miss_capacity=0;
+long cache_miss_conflict=0;
+block_map_t seen_blocks;          // every block ever touched
+block_map_t tlb_frames;           // virtual page -> physical frame
+block_map_t shadow_map;           // block -> shadow line
+shadow_line_t *shadow=NULL;
+int shadow_size=0;
+int shadow_used=0;
+int shadow_mru=-1;
+int shadow_lru=-1;
+
+int reuse_profile=0;              // reuse distance histogram (-r)
+int access_is_data=0;             // set around the MEM stage cache accesses
+block_map_t reuse_last;           // block -> time of its last access
+long *reuse_tree=NULL;            // Fenwick tree over access times
+long reuse_tree_size=0;
+long reuse_time=0;
+long reuse_hist[2][REUSE_BINS];   // [0] instruction, [1] data stream
+long reuse_cold[2];
+
 char instruction[16];
 char reg1[16];
 char reg2[16];
@@ -69,11 +380,111 @@ unsigned int instruction_count=0; // home many real instructions ran thru the pi
 unsigned int branch_predict_taken=0;
 unsigned int branch_count=0;
 unsigned int correct_branch_predictions=0;
+long trace_line=0;                // trace lines simulated so far
+int warming=0;                    // functional warming, cache state only
+
+int block_mode=0;                 // retire straight-line runs in bulk (-b)
+int block_quiet=0;                // straight-line hits just fetched
+long block_pending=0;             // queued straight-line instructions
+long block_bulk=0;
+decoded_instruction_t block_ring[MAX_STAGES];
+
+int sample_mode=0;                // sampled simulation (-s)
+long sample_unit=1000;            // measured lines per sample
+long sample_warm=2000;            // detailed lines run before each measurement
+long sample_count=30;             // initial number of samples
+double sample_error=0.03;         // target CPI relative error
+double sample_z=3.0;              // 99.7% confidence
+
+int phase_mode=0;                 // simulate representative intervals only (-P)
+long phase_interval=1000;         // trace lines per interval
+int phase_maxk=8;                 // most phases to look for
+long phase_warm=2000;             // functional warming before each representative
+
+int parallel_chunks=0;            // split the trace over this many processes (-j)
+long parallel_warm=10000;         // lines simulated ahead of each chunk
+int parallel_verify=1;            // also run serially and report the divergence
+
+int multi_mode=0;                 // several geometries per pass (-m)
+int multi_verify=0;
+int multi_isa=3;                  // widest kernel allowed, 0 scalar, 2 AVX2, 3 AVX-512
+int multi_lanes=1;
+int multi_index[MAX_LANES];
+int multi_assoc[MAX_LANES];
+int multi_mask[MAX_LANES];
+int multi_tag_shift[MAX_LANES];
+int multi_base[MAX_LANES];        // first way of the lane in the shared arrays
+int multi_offset=0;
+int multi_max_assoc=0;
+int *multi_tags=NULL;
+int *multi_stamps=NULL;
+int multi_now=0;
+long multi_hits[MAX_LANES];
+long multi_misses[MAX_LANES];
+char *multi_kernel="scalar";
+void (*iplc_sim_multi_access)(unsigned int address);
+
+/* One geometry considered by the design space exploration */
+typedef struct explore_point
+{
+    int index;
+    int blocksize;
+    int assoc;
+    unsigned long size;
+    long accesses;
+    long misses;                  // from the miss curves, in trace order
+    int candidate;                // survives the miss count pruning
+    int simulated;
+    sim_counters_t run;           // the full pipeline run, when there was one
+} explore_point_t;
+
+int explore_mode=0;               // search the geometries under a size budget (-E)
+unsigned long explore_budget=MAX_CACHE_SIZE;
+int explore_cpi=1;                // objective is CPI, else the miss rate
+double explore_slack=0.05;        // miss count margin left for the pipeline to decide
+int explore_verify=0;
+explore_point_t *explore_point=NULL;
+int explore_points=0;
+int explore_passes=0;
+int explore_simulations=0;
+
+enum results_format {RESULTS_NONE, RESULTS_JSON, RESULTS_CSV};
+enum results_format results_format=RESULTS_NONE;  // structured results (-o)
+char *results_file=NULL;
+char results_trace[1024]="";
+double results_start=0.0;
+
+enum profile_phase {PROFILE_OTHER, PROFILE_READ, PROFILE_PARSE, PROFILE_TRAP, PROFILE_PUSH,
+    PROFILE_DUMP, PROFILE_PHASES};
+int profile_enabled=0;            // per phase hardware counters (-p)
+long profile_fd=-1;               // perf_event group leader, -1 when unavailable
+char *profile_source="";
+int profile_have[PROFILE_EVENTS];
+int profile_stack[PROFILE_DEPTH];
+int profile_depth=0;
+unsigned long long profile_last[PROFILE_EVENTS];
+unsigned long long profile_total[PROFILE_PHASES][PROFILE_EVENTS];
+unsigned long profile_calls[PROFILE_PHASES];
+
+/* A trace held decoded in memory by the server */
+typedef struct server_trace
+{
+    char name[64];
+    char *file;
+    decoded_instruction_t *code;
+    long count;
+} server_trace_t;
+
+int server_mode=0;                // answer requests on a Unix socket (-D)
+char *server_socket=NULL;
+int server_workers=4;
+server_trace_t server_trace[MAX_SERVER_TRACES];
+int server_traces=0;
+volatile sig_atomic_t server_stopping=0;
 
 unsigned int debug=0;
 unsigned int dump_pipeline=1;
-
-enum instruction_type {NOP, RTYPE, LW, SW, BRANCH, JUMP, JAL, SYSCALL};
+unsigned int trace_output=1;      // per access HIT/MISS lines, off with -q
 
 typedef struct rtype
 {
@@ -133,6 +544,157 @@ enum pipeline_stages {FETCH, DECODE, ALU, MEM, WRITEBACK};
 
 pipeline_t pipeline[MAX_STAGES];
 
+enum mesi_state {MESI_I, MESI_S, MESI_E, MESI_M};
+
+/* One core's private trace, L1 and pipeline while another core is running */
+typedef struct mc_core
+{
+    char *trace_name;
+    FILE *file;
+    int done;
+    cache_line_t *cache;
+    int *state;                   // MESI state of every L1 way
+    pipeline_t pipeline[MAX_STAGES];
+    long cache_access;
+    long cache_miss;
+    long cache_hit;
+    unsigned int pipeline_cycles;
+    unsigned int instruction_count;
+    unsigned int branch_count;
+    unsigned int correct_branch_predictions;
+    unsigned int instruction_address;
+    unsigned int miss_delay;
+    long trace_line;
+    long invalidations;           // lines other cores took away
+    long writebacks;              // modified lines written back or flushed
+} mc_core_t;
+
+int mc_cores=0;                   // cores sharing an L2, 0 is the single core model (-C)
+int mc_current=0;
+mc_core_t mc_core[MAX_CORES];
+int *mc_state=NULL;               // MESI states of the running core
+int mc_fill_state=MESI_I;
+int mc_quantum=1000;
+int mc_c2c_delay=6;
+int mc_upgrade_delay=2;
+long mc_bus_rd=0, mc_bus_rdx=0, mc_bus_upgr=0, mc_invalidations=0, mc_c2c=0;
+int access_is_write=0;            // set around the SW stage cache access
+
+int l2_index=8;
+int l2_assoc=8;
+int l2_hit_delay=4;
+unsigned int *l2_tag=NULL;
+unsigned long *l2_stamp=NULL;
+unsigned long l2_clock=0;
+long l2_access=0, l2_miss=0;
+
+int loop_mode=0;                  // skip iterations of loops in a steady state (-L)
+unsigned int loop_head=0;         // first address of the iteration being recorded
+unsigned int loop_last_address=0;
+int loop_lines=0;                 // lines recorded so far, -1 when there were too many
+char loop_body[MAX_LOOP_LINES][80];
+assoc_t *loop_assoc=NULL;         // the state the iteration started in
+int *loop_replacement=NULL;
+pipeline_t loop_pipeline[MAX_STAGES];
+int loop_fast_valid=0;
+unsigned int loop_fast_block=0;
+int loop_fast_way=0;
+int loop_block_quiet=0;
+sim_counters_t loop_counters;
+long loop_fast_hits=0, loop_block_bulk=0;
+long loop_iterations=0;           // iterations accounted for without simulating them
+long loop_skipped=0;
+
+/* One trace line's pipeline, kept in case a trigger fires soon after */
+typedef struct trigger_record
+{
+    unsigned int cycle;
+    pipeline_t stage[MAX_STAGES];
+} trigger_record_t;
+
+enum trigger_event {TRIGGER_IMISS, TRIGGER_DMISS, TRIGGER_STALL, TRIGGER_MISPREDICT, TRIGGER_EVENTS};
+char *trigger_event_name[TRIGGER_EVENTS] = {"imiss", "dmiss", "stall", "mispredict"};
+int trigger_mode=0;               // print only the windows around triggers (-T)
+unsigned int trigger_pc_lo=1, trigger_pc_hi=0;
+unsigned int trigger_cycle_lo=1, trigger_cycle_hi=0;
+long trigger_nth[TRIGGER_EVENTS]; // occurrence of each event that fires, 0 for none
+long trigger_seen[TRIGGER_EVENTS];
+int trigger_miss_set=0;
+unsigned int trigger_miss_address=0;
+int trigger_pre=16;               // lines printed from before the trigger
+int trigger_post=16;              // and after it
+trigger_record_t *trigger_ring=NULL;
+long trigger_recorded=0;
+long trigger_remaining=0;         // lines of the open window still to print
+int trigger_pending=0;
+char trigger_reason[64];
+long trigger_windows=0;
+
+FILE *timeline_file=NULL;         // Chrome trace event export (-X)
+unsigned int timeline_last=0;     // cycle of the previous push
+
+/* One static instruction of a program run by the functional front-end */
+enum func_op {FUNC_ADD, FUNC_ADDI, FUNC_ORI, FUNC_SLL, FUNC_LUI, FUNC_LW, FUNC_SW,
+              FUNC_BEQ, FUNC_J, FUNC_JAL, FUNC_JR, FUNC_SYSCALL, FUNC_NOP};
+
+typedef struct func_instruction
+{
+    enum func_op op;
+    int rd, rs, rt;
+    int imm;                      // immediate, byte offset or jump target
+    char text[64];                // the instruction as a trace shows it
+    decoded_instruction_t decoded;
+} func_instruction_t;
+
+int func_mode=0;                  // execute a program instead of reading a trace (-F)
+char *func_program=NULL;
+char *func_dump_name=NULL;        // where the executed instructions are written as a trace
+unsigned int func_entry=0;
+unsigned int func_sp=0x7fffeffc;
+long func_max=0;                  // instructions to run at most, 0 for no limit
+long func_executed=0;
+func_instruction_t *func_code=NULL;
+func_instruction_t **func_text=NULL;  // the instruction at each word of the text segment
+unsigned int func_text_base=0;
+unsigned int func_text_words=0;
+block_map_t func_memory;          // word address -> value
+
+/* Start of a compressed trace file */
+typedef struct ztrace_header
+{
+    char magic[8];
+    long lines;
+    long entries;                 // dictionary size
+    long blocks;
+    long block_lines;
+    long dictionary_offset;
+    long index_offset;
+} ztrace_header_t;
+
+/* Where one block of a compressed trace is */
+typedef struct ztrace_block
+{
+    long offset;
+    long bytes;
+} ztrace_block_t;
+
+int ztrace_mode=0;                // the trace is compressed
+FILE *ztrace_file=NULL;
+ztrace_header_t ztrace_header;
+ztrace_block_t *ztrace_index=NULL;
+unsigned int *ztrace_pc=NULL;     // per dictionary entry
+unsigned char *ztrace_has_data=NULL;
+int *ztrace_next=NULL;            // entry of the sequential successor, or -1
+decoded_instruction_t *ztrace_template=NULL;
+unsigned int *ztrace_last=NULL;   // data address and stride of each entry in this block
+unsigned int *ztrace_stride=NULL;
+long *ztrace_stamp=NULL;          // block load the entry's last and stride belong to
+unsigned char *ztrace_buffer=NULL;
+unsigned char *ztrace_cursor=NULL, *ztrace_end=NULL;
+long ztrace_block=0;
+long ztrace_loads=0;              // blocks loaded so far, each one starts with no history
+int ztrace_prev=-1;
+
 /************************************************************************************************/
 /* Cache Functions ******************************************************************************/
 /************************************************************************************************/
@@ -141,7 +703,7 @@ pipeline_t pipeline[MAX_STAGES];
  */
 void iplc_sim_init(int index, int blocksize, int assoc)
 {
-    int i=0, j=0;
+    int i=0;
     unsigned long cache_size = 0;
     cache_index = index;
     cache_blocksize = blocksize;
@@ -152,7 +714,7 @@ void iplc_sim_init(int index, int blocksize, int assoc)
     (int) rint((log( (double) (blocksize * 4) )/ log(2)));
     /* Note: rint function rounds the result up prior to casting */
     
-    cache_size = assoc * ( 1 << index ) * ((32 * blocksize) + 33 - index - cache_blockoffsetbits);
+    cache_size = iplc_sim_cache_size(index, blocksize, assoc);
     
     printf("Cache Configuration \n");
     printf("   Index: %d bits or %d lines \n", cache_index, (1<<cache_index) );
@@ -166,6 +728,57 @@ void iplc_sim_init(int index, int blocksize, int assoc)
         exit(-1);
     }
     
+    iplc_sim_build_cache(index, assoc);
+    
+    if (victim_entries)
+        iplc_sim_victim_init();
+    if (dram_enabled)
+        iplc_sim_dram_init();
+    if (tlb_enabled)
+        iplc_sim_tlb_init();
+    if (classify_misses)
+        iplc_sim_classify_init();
+    if (reuse_profile)
+        iplc_sim_reuse_init();
+    
+    // init the pipeline -- set all data to zero and instructions to NOP
+    for (i = 0; i < MAX_STAGES; i++) {
+        // itype is set to O which is NOP type instruction
+        bzero(&(pipeline[i]), sizeof(pipeline_t));
+    }
+}
+
+/*
+ * Bits of storage for data, tag and valid bit over every line.
+ */
+unsigned long iplc_sim_cache_size(int index, int blocksize, int assoc)
+{
+    int offsetbits = (int) rint((log( (double) (blocksize * 4) )/ log(2)));
+    
+    return assoc * ( 1UL << index ) * ((32 * blocksize) + 33 - index - offsetbits);
+}
+
+/*
+ * (Re)allocate the cache sets for a geometry, all lines invalid.
+ */
+void iplc_sim_build_cache(int index, int assoc)
+{
+    static int sets = 0;
+    int i=0, j=0;
+    
+    if (cache) {
+        for (i = 0; i < sets; i++) {
+            free(cache[i].assoc);
+            free(cache[i].replacement);
+        }
+        free(cache);
+    }
+    cache_index = index;
+    cache_assoc = assoc;
+    iplc_sim_select_kernels(assoc);
+    fast_valid = 0;
+    
+    sets = 1<<index;
     cache = (cache_line_t *) malloc((sizeof(cache_line_t) * 1<<index));
     
     for (i = 0; i < (1<<index); i++) {
@@ -178,11 +791,71 @@ void iplc_sim_init(int index, int blocksize, int assoc)
             cache[i].replacement[j] = j;
         }
     }
+}
+
+/*
+ * Put the simulator back into the state iplc_sim_init() left it in, keeping
+ * the configuration and allocations.  Lets one process simulate the same
+ * configuration several times.
+ */
+void iplc_sim_reset()
+{
+    int i=0, j=0;
     
-    // init the pipeline -- set all data to zero and instructions to NOP
-    for (i = 0; i < MAX_STAGES; i++) {
-        // itype is set to O which is NOP type instruction
+    for (i = 0; i < (1<<cache_index); i++) {
+        for (j = 0; j < cache_assoc; j++) {
+            cache[i].assoc[j].vb = 0;
+            cache[i].assoc[j].tag = 0;
+            cache[i].replacement[j] = j;
+        }
+    }
+    cache_miss = cache_access = cache_hit = 0;
+    miss_delay = CACHE_MISS_DELAY;
+    fast_valid = 0;
+    fast_hits = 0;
+    block_quiet = 0;
+    block_pending = 0;
+    block_bulk = 0;
+    
+    pipeline_cycles = 0;
+    instruction_count = 0;
+    branch_count = 0;
+    correct_branch_predictions = 0;
+    trace_line = 0;
+    for (i = 0; i < MAX_STAGES; i++)
         bzero(&(pipeline[i]), sizeof(pipeline_t));
+    
+    // the counters are cleared even for features that are off, since the
+    // server switches features between runs of one process
+    victim_clock = 0;
+    victim_hit = 0;
+    dram_requests = dram_row_hits = dram_row_misses = dram_row_conflicts = 0;
+    dram_bypasses = dram_queue_full = dram_latency = 0;
+    cache_miss_compulsory = cache_miss_capacity = cache_miss_conflict = 0;
+    bzero(reuse_hist, sizeof(reuse_hist));
+    bzero(reuse_cold, sizeof(reuse_cold));
+    
+    if (victim_entries)
+        bzero(victim, sizeof(victim_line_t) * victim_entries);
+    if (dram_enabled) {
+        free(dram_bank);
+        iplc_sim_dram_init();
+    }
+    if (tlb_enabled)
+        iplc_sim_tlb_init();
+    if (classify_misses) {
+        free(shadow);
+        free(shadow_map.key);
+        free(shadow_map.val);
+        free(seen_blocks.key);
+        free(seen_blocks.val);
+        iplc_sim_classify_init();
+    }
+    if (reuse_profile) {
+        free(reuse_tree);
+        free(reuse_last.key);
+        free(reuse_last.val);
+        iplc_sim_reuse_init();
     }
 }
 
@@ -197,6 +870,10 @@ void iplc_sim_LRU_replace_on_miss(int index, int tag)
     i = cache[index].replacement[0];
     /* Note: item 0 is the least recently used cache slot -- so replace it */
  
+    // the line being thrown out goes to the victim cache
+    if (victim_entries && cache[index].assoc[i].vb)
+        iplc_sim_victim_insert(((unsigned int) cache[index].assoc[i].tag << cache_index) | index);
+ 
      /* percolate everything up */
     for(j = 1; j < cache_assoc; ++j){
       cache[index].replacement[j-1] = cache[index].replacement[j];
@@ -236,394 +913,5512 @@ void iplc_sim_LRU_update_on_hit(int index, int assoc)
  * associativity we may need to check through multiple entries for our
  * desired index.  In that case we will also need to call the LRU functions.
  */
-int iplc_sim_trap_address(unsigned int address)
+/*
+ * Lookup and LRU kernels with the associativity fixed at compile time, so
+ * the way loops unroll completely.  Each mirrors the generic routine above
+ * it, victim cache hand-off included.
+ */
+#define IPLC_SIM_CACHE_KERNELS(N)                                                   \
+int iplc_sim_lookup_##N(int index, int tag)                                         \
+{                                                                                   \
+    assoc_t *way = cache[index].assoc;                                              \
+    int i;                                                                          \
+    _Pragma("GCC unroll 16")                                                        \
+    for (i = 0; i < N; i++)                                                         \
+        if (way[i].vb && way[i].tag == tag)                                         \
+            return i;                                                               \
+    return -1;                                                                      \
+}                                                                                   \
+                                                                                    \
+void iplc_sim_LRU_update_on_hit_##N(int index, int assoc)                           \
+{                                                                                   \
+    int *replacement = cache[index].replacement;                                    \
+    int i, moving = 0;                                                              \
+    _Pragma("GCC unroll 16")                                                        \
+    for (i = 0; i < N - 1; i++) {                                                   \
+        moving |= (replacement[i] == assoc);                                        \
+        if (moving)                                                                 \
+            replacement[i] = replacement[i+1];                                      \
+    }                                                                               \
+    replacement[N-1] = assoc;                                                       \
+}                                                                                   \
+                                                                                    \
+void iplc_sim_LRU_replace_on_miss_##N(int index, int tag)                           \
+{                                                                                   \
+    int *replacement = cache[index].replacement;                                    \
+    int i = replacement[0], j;                                                      \
+                                                                                    \
+    if (victim_entries && cache[index].assoc[i].vb)                                 \
+        iplc_sim_victim_insert(((unsigned int) cache[index].assoc[i].tag << cache_index) | index); \
+    _Pragma("GCC unroll 16")                                                        \
+    for (j = 1; j < N; j++)                                                         \
+        replacement[j-1] = replacement[j];                                          \
+    replacement[N-1] = i;                                                           \
+    cache[index].assoc[i].vb = 1;                                                   \
+    cache[index].assoc[i].tag = tag;                                                \
+}
+
+IPLC_SIM_CACHE_KERNELS(1)
+IPLC_SIM_CACHE_KERNELS(2)
+IPLC_SIM_CACHE_KERNELS(4)
+IPLC_SIM_CACHE_KERNELS(8)
+IPLC_SIM_CACHE_KERNELS(16)
+
+int iplc_sim_lookup_generic(int index, int tag)
 {
-    int i=0, index=0;
-    int tag=0;
-    int hit=0;
+    int i;
     
-    /* expects you to return 1 for hit, 0 for miss */
-    return hit;
+    for (i = 0; i < cache_assoc; i++)
+        if (cache[index].assoc[i].vb && cache[index].assoc[i].tag == tag)
+            return i;
+    return -1;
 }
 
 /*
- * Just output our summary statistics.
+ * Point the cache hooks at the kernels for this associativity.
  */
-void iplc_sim_finalize()
+void iplc_sim_select_kernels(int assoc)
 {
-    /* Finish processing all instructions in the Pipeline */
-    while (pipeline[FETCH].itype != NOP  ||
-           pipeline[DECODE].itype != NOP ||
-           pipeline[ALU].itype != NOP    ||
-           pipeline[MEM].itype != NOP    ||
-           pipeline[WRITEBACK].itype != NOP) {
-        iplc_sim_push_pipeline_stage();
+    switch (assoc) {
+#define IPLC_SIM_SELECT(N)                                                          \
+        case N:                                                                     \
+            iplc_sim_cache_lookup = iplc_sim_lookup_##N;                            \
+            iplc_sim_cache_update = iplc_sim_LRU_update_on_hit_##N;                 \
+            iplc_sim_cache_replace = iplc_sim_LRU_replace_on_miss_##N;              \
+            break;
+        IPLC_SIM_SELECT(1)
+        IPLC_SIM_SELECT(2)
+        IPLC_SIM_SELECT(4)
+        IPLC_SIM_SELECT(8)
+        IPLC_SIM_SELECT(16)
+#undef IPLC_SIM_SELECT
+        default:
+            iplc_sim_cache_lookup = iplc_sim_lookup_generic;
+            iplc_sim_cache_update = iplc_sim_LRU_update_on_hit;
+            iplc_sim_cache_replace = iplc_sim_LRU_replace_on_miss;
+            break;
+    }
+}
+
+int iplc_sim_trap_address(unsigned int address)
+{
+    int i=0, index=0;
+    int tag=0;
+    int hit=0;
+    int swapped=0;  // missed, but the victim cache had the block
+    unsigned int block = address >> cache_blockoffsetbits;
+    
+    if (profile_enabled)
+        iplc_sim_profile_enter(PROFILE_TRAP);
+    
+    index = block & ((1 << cache_index) - 1);
+    tag = address >> (cache_blockoffsetbits + cache_index);
+    
+    cache_access++;
+    
+    // the block touched last is still the MRU line of its set, no probe or LRU update needed
+    if (fast_valid && block == fast_block &&
+        cache[index].assoc[fast_way].vb && cache[index].assoc[fast_way].tag == tag) {
+        i = fast_way;
+        hit = 1;
+        fast_hits++;
+    }
+    else {
+        i = iplc_sim_cache_lookup(index, tag);
+        hit = (i >= 0);
+        if (hit)
+            iplc_sim_cache_update(index, i);
     }
     
-    printf(" Cache Performance \n");
-    printf("\t Number of Cache Accesses is %ld \n", cache_access);
-    printf("\t Number of Cache Misses is %ld \n", cache_miss);
-    printf("\t Number of Cache Hits is %ld \n", cache_hit);
-    printf("\t Cache Miss Rate is %f \n\n", (double)cache_miss / (double)cache_access);
-    printf("Pipeline Performance \n");
-    printf("\t Total Cycles is %u \n", pipeline_cycles);
-    printf("\t Total Instructions is %u \n", instruction_count);
-    printf("\t Total Branch Instructions is %u \n", branch_count);
-    printf("\t Total Correct Branch Predictions is %u \n", correct_branch_predictions);
-    printf("\t CPI is %f \n\n", (double)pipeline_cycles / (double)instruction_count);
+    if (hit) {
+        cache_hit++;
+        if (mc_cores)
+            iplc_sim_mc_hit(index, i, access_is_write);
+    }
+    else {
+        cache_miss++;
+        if (trigger_mode && !warming)
+            iplc_sim_trigger_miss(address);
+        
+        // a victim hit swaps the line back in for a fraction of the miss cost
+        if (victim_entries &&
+            iplc_sim_victim_probe(address >> cache_blockoffsetbits)) {
+            victim_hit++;
+            swapped = 1;
+            if (!warming)
+                pipeline_cycles += VICTIM_HIT_DELAY;
+        }
+        
+        else if (dram_enabled && !warming)
+            miss_delay = iplc_sim_dram_access(address, pipeline_cycles);
+        
+        else if (mc_cores)
+            miss_delay = iplc_sim_mc_miss(index, tag, access_is_write);
+        
+        iplc_sim_cache_replace(index, tag);
+        i = cache[index].replacement[cache_assoc - 1];
+        if (mc_cores)
+            mc_state[index * cache_assoc + i] = mc_fill_state;
+    }
+    fast_valid = 1;
+    fast_block = block;
+    fast_index = index;
+    fast_way = i;
+    
+    if (classify_misses)
+        iplc_sim_classify_access(address, hit);
+    if (reuse_profile)
+        iplc_sim_reuse_access(address, access_is_data);
+    
+    if (profile_enabled)
+        iplc_sim_profile_exit();
+    
+    /* expects you to return 1 for hit, 0 for miss */
+    return hit || swapped;
 }
 
 /************************************************************************************************/
-/* Pipeline Functions ***************************************************************************/
+/* Victim Cache Functions ***********************************************************************/
 /************************************************************************************************/
 
+void iplc_sim_victim_init()
+{
+    victim = (victim_line_t *)calloc(victim_entries, sizeof(victim_line_t));
+}
+
 /*
- * Dump the current contents of our pipeline.
+ * Look for the block among the victims.  On a hit the entry is handed back to
+ * the main cache, so it is invalidated here; the line the main cache evicts to
+ * make room takes its place through iplc_sim_victim_insert().
  */
-void iplc_sim_dump_pipeline()
+int iplc_sim_victim_probe(unsigned int block)
 {
     int i;
     
-    for (i = 0; i < MAX_STAGES; i++) {
-        switch(i) {
-            case FETCH:
-                printf("(cyc: %u) FETCH:\t %d: 0x%x \t", pipeline_cycles, pipeline[i].itype, pipeline[i].instruction_address);
-                break;
-            case DECODE:
-                printf("DECODE:\t %d: 0x%x \t", pipeline[i].itype, pipeline[i].instruction_address);
-                break;
-            case ALU:
-                printf("ALU:\t %d: 0x%x \t", pipeline[i].itype, pipeline[i].instruction_address);
-                break;
-            case MEM:
-                printf("MEM:\t %d: 0x%x \t", pipeline[i].itype, pipeline[i].instruction_address);
-                break;
-            case WRITEBACK:
-                printf("WB:\t %d: 0x%x \n", pipeline[i].itype, pipeline[i].instruction_address);
-                break;
-            default:
-                printf("DUMP: Bad stage!\n" );
-                exit(-1);
+    for (i = 0; i < victim_entries; i++) {
+        if (victim[i].vb && victim[i].block == block) {
+            victim[i].vb = 0;
+            return 1;
         }
     }
+    return 0;
 }
 
 /*
- * Check if various stages of our pipeline require stalls, forwarding, etc.
- * Then push the contents of our various pipeline stages through the pipeline.
+ * Take a line evicted from the main cache, replacing the least recently
+ * inserted victim if there is no free entry.
  */
-void iplc_sim_push_pipeline_stage()
+void iplc_sim_victim_insert(unsigned int block)
 {
-    int i;
-    int data_hit=1;
-    
-    /* 1. Count WRITEBACK stage is "retired" -- This I'm giving you */
-    if (pipeline[WRITEBACK].instruction_address) {
-        instruction_count++;
-        if (debug)
-            printf("DEBUG: Retired Instruction at 0x%x, Type %d, at Time %u \n",
-                   pipeline[WRITEBACK].instruction_address, pipeline[WRITEBACK].itype, pipeline_cycles);
-    }
-    
-    /* 2. Check for BRANCH and correct/incorrect Branch Prediction */
-    if (pipeline[DECODE].itype == BRANCH) {
-        int branch_taken = 0;
-    }
-    
-    /* 3. Check for LW delays due to use in ALU stage and if data hit/miss
-     *    add delay cycles if needed.
-     */
-    if (pipeline[MEM].itype == LW) {
-        int inserted_nop = 0;
-    }
+    int i, slot = 0;
     
-    /* 4. Check for SW mem acess and data miss .. add delay cycles if needed */
-    if (pipeline[MEM].itype == SW) {
+    for (i = 0; i < victim_entries; i++) {
+        if (!victim[i].vb) {
+            slot = i;
+            break;
+        }
+        if (victim[i].age < victim[slot].age)
+            slot = i;
     }
     
-    /* 5. Increment pipe_cycles 1 cycle for normal processing */
-    /* 6. push stages thru MEM->WB, ALU->MEM, DECODE->ALU, FETCH->ALU */
-    
-    // 7. This is a give'me -- Reset the FETCH stage to NOP via bezero */
-    bzero(&(pipeline[FETCH]), sizeof(pipeline_t));
+    victim[slot].vb = 1;
+    victim[slot].block = block;
+    victim[slot].age = ++victim_clock;
 }
 
+/************************************************************************************************/
+/* DRAM Functions *******************************************************************************/
+/************************************************************************************************/
+
 /*
- * This function is fully implemented.  You should use this as a reference
- * for implementing the remaining instruction types.
+ * Parse a comma separated list such as "banks=8,row=2048,sched=fcfs".  Any
+ * key left out keeps its default.
  */
-void iplc_sim_process_pipeline_rtype(char *instruction, int dest_reg, int reg1, int reg2_or_constant)
+void iplc_sim_dram_configure(char *spec)
 {
-    /* This is an example of what you need to do for the rest */
-    iplc_sim_push_pipeline_stage();
+    char *opt, key[32], value[32];
     
-    pipeline[FETCH].itype = RTYPE;
-    pipeline[FETCH].instruction_address = instruction_address;
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (sscanf(opt, "%31[^=]=%31s", key, value) != 2) {
+            strcpy(key, "sched");
+            strncpy(value, opt, sizeof(value) - 1);
+            value[sizeof(value) - 1] = '\0';
+        }
+        
+        if (strcmp(key, "banks") == 0)
+            dram_banks = atoi(value);
+        else if (strcmp(key, "row") == 0)
+            dram_row_bytes = atoi(value);
+        else if (strcmp(key, "hit") == 0)
+            dram_row_hit = atoi(value);
+        else if (strcmp(key, "miss") == 0)
+            dram_row_miss = atoi(value);
+        else if (strcmp(key, "conflict") == 0)
+            dram_row_conflict = atoi(value);
+        else if (strcmp(key, "bw") == 0)
+            dram_bus_bytes = atoi(value);
+        else if (strcmp(key, "queue") == 0)
+            dram_queue_depth = atoi(value);
+        else if (strcmp(key, "sched") == 0 && strcmp(value, "fcfs") == 0)
+            dram_frfcfs = 0;
+        else if (strcmp(key, "sched") == 0 && strcmp(value, "frfcfs") == 0)
+            dram_frfcfs = 1;
+        else {
+            printf("Unknown DRAM option: %s \n", opt);
+            exit(-1);
+        }
+    }
     
-    strcpy(pipeline[FETCH].stage.rtype.instruction, instruction);
-    pipeline[FETCH].stage.rtype.reg1 = reg1;
-    pipeline[FETCH].stage.rtype.reg2_or_constant = reg2_or_constant;
-    pipeline[FETCH].stage.rtype.dest_reg = dest_reg;
+    if (dram_banks < 1 || dram_row_bytes < 4 || dram_bus_bytes < 1 ||
+        dram_queue_depth < 1 || dram_queue_depth > MAX_DRAM_QUEUE) {
+        printf("Bad DRAM configuration \n");
+        exit(-1);
+    }
+    dram_enabled = 1;
 }
 
-void iplc_sim_process_pipeline_lw(int dest_reg, int base_reg, unsigned int data_address)
+void iplc_sim_dram_init()
 {
-    /* You must implement this function */
-    iplc_sim_push_pipeline_stage();
+    int i;
+    
+    dram_bank = (dram_bank_t *)malloc(sizeof(dram_bank_t) * dram_banks);
+    for (i = 0; i < dram_banks; i++) {
+        dram_bank[i].open_row = -1;
+        dram_bank[i].ready = 0;
+    }
+    dram_bus_ready = 0;
+    dram_queued = 0;
+}
 
-    pipeline[MEM].itype = LW;
+/*
+ * Drop requests that have completed by time now.
+ */
+void iplc_sim_dram_retire(unsigned long now)
+{
+    int i, j;
+    
+    for (i = 0, j = 0; i < dram_queued; i++)
+        if (dram_queue[i].done > now)
+            dram_queue[j++] = dram_queue[i];
+    dram_queued = j;
+}
 
-    pipeline[MEM].stage.lw.data_address = data_address;
-    pipeline[MEM].stage.lw.dest_reg = dest_reg;
-    pipeline[MEM].stage.base_reg = base_reg;
+/*
+ * Schedule a block fill that arrives at time now and return the number of
+ * cycles until its data is back.  Addresses map as row:bank:column.
+ *
+ * Store fills are posted, so several requests can be outstanding at once.
+ * Every request in the queue already has a service slot on its bank.  FCFS
+ * simply goes after the last of them.  FR-FCFS lets a row hit jump ahead of a
+ * queued request that has not started yet and would close the row; the
+ * bypassed requests on that bank slide back by the hit's service time.
+ */
+unsigned int iplc_sim_dram_access(unsigned int address, unsigned long now)
+{
+    unsigned long arrive = now, start, ready, service;
+    unsigned int xfer;
+    int bank, row, i, first = -1;
+    dram_request_t *req;
+    
+    bank = (address / dram_row_bytes) % dram_banks;
+    row = address / dram_row_bytes / dram_banks;
+    xfer = (cache_blocksize * 4 + dram_bus_bytes - 1) / dram_bus_bytes;
+    
+    iplc_sim_dram_retire(arrive);
+    if (dram_queued == dram_queue_depth) {
+        // controller is full, wait for the oldest slot to free up
+        ready = dram_queue[0].done;
+        for (i = 1; i < dram_queued; i++)
+            if (dram_queue[i].done < ready)
+                ready = dram_queue[i].done;
+        arrive = ready;
+        dram_queue_full++;
+        iplc_sim_dram_retire(arrive);
+    }
+    dram_wait = arrive - now;
+    
+    dram_requests++;
+    
+    if (dram_frfcfs && dram_bank[bank].open_row != row) {
+        for (i = 0; i < dram_queued; i++) {
+            if (dram_queue[i].bank == bank && dram_queue[i].start > arrive &&
+                dram_queue[i].prev_row == row && dram_queue[i].row != row &&
+                (first == -1 || dram_queue[i].start < dram_queue[first].start))
+                first = i;
+        }
+    }
+    
+    req = &dram_queue[dram_queued++];
+    req->bank = bank;
+    req->row = row;
+    
+    if (first != -1) {
+        start = dram_queue[first].start;
+        service = dram_row_hit + xfer;
+        for (i = 0; i < dram_queued - 1; i++) {
+            if (dram_queue[i].bank == bank && dram_queue[i].start >= start) {
+                dram_queue[i].start += service;
+                dram_queue[i].done += service;
+            }
+        }
+        dram_bank[bank].ready += service;
+        req->prev_row = row;
+        req->start = start;
+        req->done = start + service;
+        if (req->done > dram_bus_ready)
+            dram_bus_ready = req->done;
+        dram_row_hits++;
+        dram_bypasses++;
+    }
+    else {
+        start = arrive > dram_bank[bank].ready ? arrive : dram_bank[bank].ready;
+        if (dram_bank[bank].open_row == row) {
+            service = dram_row_hit;
+            dram_row_hits++;
+        }
+        else if (dram_bank[bank].open_row == -1) {
+            service = dram_row_miss;
+            dram_row_misses++;
+        }
+        else {
+            service = dram_row_conflict;
+            dram_row_conflicts++;
+        }
+        
+        // the data bus is shared by all banks
+        ready = start + service;
+        if (ready < dram_bus_ready)
+            ready = dram_bus_ready;
+        
+        req->prev_row = dram_bank[bank].open_row;
+        req->start = start;
+        req->done = ready + xfer;
+        dram_bank[bank].open_row = row;
+        dram_bank[bank].ready = req->done;
+        dram_bus_ready = req->done;
+    }
+    
+    dram_latency += req->done - now;
+    return req->done - now;
 }
 
-void iplc_sim_process_pipeline_sw(int src_reg, int base_reg, unsigned int data_address)
+void iplc_sim_dram_report()
 {
-    /* You must implement this function */
-    iplc_sim_push_pipeline_stage();
+    printf(" DRAM Performance \n");
+    printf("\t Banks is %d, Row Size is %d bytes, Scheduler is %s \n",
+           dram_banks, dram_row_bytes, dram_frfcfs ? "FR-FCFS" : "FCFS");
+    printf("\t Number of DRAM Requests is %ld \n", dram_requests);
+    printf("\t Row Buffer Hits is %ld \n", dram_row_hits);
+    printf("\t Row Buffer Misses is %ld \n", dram_row_misses);
+    printf("\t Row Buffer Conflicts is %ld \n", dram_row_conflicts);
+    printf("\t Row Hit Bypasses is %ld \n", dram_bypasses);
+    printf("\t Queue Full Stalls is %ld \n", dram_queue_full);
+    printf("\t Average Miss Latency is %f \n\n",
+           dram_requests ? (double)dram_latency / (double)dram_requests : 0.0);
+}
 
-    pipeline[MEM].itype = SW;
+/************************************************************************************************/
+/* Miss Classification Functions ****************************************************************/
+/************************************************************************************************/
 
-    pipeline[MEM].stage.sw.data_address = data_address;
-    pipeline[MEM].stage.sw.src_reg = src_reg;
-    pipeline[MEM].stage.sw.base_reg = base_reg;
+unsigned int block_map_hash(unsigned int key)
+{
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key;
 }
 
-void iplc_sim_process_pipeline_branch(int reg1, int reg2)
+/*
+ * slots must be a power of two.
+ */
+void block_map_init(block_map_t *map, unsigned int slots)
 {
-    /* You must implement this function */
-    iplc_sim_push_pipeline_stage();
-
-    pipeline[DECODE].itype = BRANCH;
+    unsigned int i;
+    
+    map->key = (unsigned int *)malloc(sizeof(unsigned int) * slots);
+    map->val = (long *)malloc(sizeof(long) * slots);
+    map->mask = slots - 1;
+    map->count = 0;
+    
+    for (i = 0; i < slots; i++)
+        map->val[i] = -1;
+}
 
-    pipeline[DECODE].stage.branch.reg1 = reg1;
-    pipeline[DECODE].stage.branch.reg2 = reg2;
+long block_map_get(block_map_t *map, unsigned int key)
+{
+    unsigned int i = block_map_hash(key) & map->mask;
+    
+    while (map->val[i] != -1) {
+        if (map->key[i] == key)
+            return map->val[i];
+        i = (i + 1) & map->mask;
+    }
+    return -1;
 }
 
-void iplc_sim_process_pipeline_jump(char *instruction)
+void block_map_put(block_map_t *map, unsigned int key, long val)
 {
-    /* You must implement this function */
-    iplc_sim_push_pipeline_stage();
+    unsigned int i;
+    
+    // keep the load factor under 1/2 so probe sequences stay short
+    if ((map->count + 1) * 2 > map->mask + 1) {
+        block_map_t bigger;
+        
+        block_map_init(&bigger, (map->mask + 1) * 2);
+        for (i = 0; i <= map->mask; i++)
+            if (map->val[i] != -1)
+                block_map_put(&bigger, map->key[i], map->val[i]);
+        free(map->key);
+        free(map->val);
+        *map = bigger;
+    }
+    
+    i = block_map_hash(key) & map->mask;
+    while (map->val[i] != -1) {
+        if (map->key[i] == key) {
+            map->val[i] = val;
+            return;
+        }
+        i = (i + 1) & map->mask;
+    }
+    map->key[i] = key;
+    map->val[i] = val;
+    map->count++;
+}
 
-    pipeline[ALU].itype = JUMP;
+/*
+ * Backward shift deletion -- no tombstones, so lookups never slow down.
+ */
+void block_map_delete(block_map_t *map, unsigned int key)
+{
+    unsigned int i, j, home;
+    
+    i = block_map_hash(key) & map->mask;
+    while (map->key[i] != key || map->val[i] == -1) {
+        if (map->val[i] == -1)
+            return;
+        i = (i + 1) & map->mask;
+    }
+    
+    for (j = (i + 1) & map->mask; map->val[j] != -1; j = (j + 1) & map->mask) {
+        home = block_map_hash(map->key[j]) & map->mask;
+        // move entry j into the hole unless its home lies cyclically in (i, j]
+        if ((j > i && (home <= i || home > j)) ||
+            (j < i && (home <= i && home > j))) {
+            map->key[i] = map->key[j];
+            map->val[i] = map->val[j];
+            i = j;
+        }
+    }
+    map->val[i] = -1;
+    map->count--;
+}
 
-    strcpy(pipeline[ALU].stage.jump.instruction, instruction);
+/*
+ * The shadow cache is fully associative with the same number of blocks as the
+ * real one, so anything it misses on would have missed in any organization.
+ */
+void iplc_sim_classify_init()
+{
+    unsigned int slots = 16;
+    
+    shadow_size = (1 << cache_index) * cache_assoc;
+    shadow = (shadow_line_t *)malloc(sizeof(shadow_line_t) * shadow_size);
+    shadow_used = 0;
+    shadow_mru = shadow_lru = -1;
+    
+    while (slots < 2 * shadow_size)
+        slots <<= 1;
+    block_map_init(&shadow_map, slots);
+    block_map_init(&seen_blocks, 1024);
 }
 
-void iplc_sim_process_pipeline_syscall()
+void iplc_sim_shadow_unlink(int line)
 {
-    /* You must implement this function */
-    iplc_sim_push_pipeline_stage();
+    if (shadow[line].prev != -1)
+        shadow[shadow[line].prev].next = shadow[line].next;
+    else
+        shadow_mru = shadow[line].next;
+    
+    if (shadow[line].next != -1)
+        shadow[shadow[line].next].prev = shadow[line].prev;
+    else
+        shadow_lru = shadow[line].prev;
+}
 
-    pipeline[WRITEBACK].itype = SYSCALL;
+void iplc_sim_shadow_push_mru(int line)
+{
+    shadow[line].prev = -1;
+    shadow[line].next = shadow_mru;
+    if (shadow_mru != -1)
+        shadow[shadow_mru].prev = line;
+    shadow_mru = line;
+    if (shadow_lru == -1)
+        shadow_lru = line;
 }
 
-void iplc_sim_process_pipeline_nop()
+/*
+ * Called by iplc_sim_trap_address() for every access once the real cache has
+ * decided hit or miss.  Keeps the shadow cache in step and classifies misses:
+ *   compulsory - first touch of the block
+ *   capacity   - the fully associative shadow missed too
+ *   conflict   - the shadow hit, so only the mapping caused the miss
+ */
+void iplc_sim_classify_access(unsigned int address, int hit)
 {
-    /* You must implement this function */
-    iplc_sim_push_pipeline_stage();
+    unsigned int block = address >> cache_blockoffsetbits;
+    int line = (int) block_map_get(&shadow_map, block);
+    int shadow_hit = (line != -1);
     
-    pipeline[FETCH].itype = NOP;
-    pipeline[DECODE].itype = NOP;
-    pipeline[ALU].itype = NOP;
-    pipeline[MEM].itype = NOP;
-    pipeline[WRITEBACK].itype = NOP;
+    if (shadow_hit) {
+        iplc_sim_shadow_unlink(line);
+    }
+    else {
+        if (shadow_used < shadow_size)
+            line = shadow_used++;
+        else {
+            line = shadow_lru;
+            iplc_sim_shadow_unlink(line);
+            block_map_delete(&shadow_map, shadow[line].block);
+        }
+        shadow[line].block = block;
+        block_map_put(&shadow_map, block, line);
+    }
+    iplc_sim_shadow_push_mru(line);
+    
+    if (hit)
+        return;
+    
+    // a block's first touch is always a miss, so only misses need recording
+    if (block_map_get(&seen_blocks, block) == -1) {
+        cache_miss_compulsory++;
+        block_map_put(&seen_blocks, block, 0);
+    }
+    else if (!shadow_hit)
+        cache_miss_capacity++;
+    else
+        cache_miss_conflict++;
 }
 
 /************************************************************************************************/
-/* parse Function *******************************************************************************/
+/* Reuse Distance Functions *********************************************************************/
 /************************************************************************************************/
 
+void iplc_sim_reuse_init()
+{
+    reuse_tree_size = 1 << 16;
+    reuse_tree = (long *)calloc(reuse_tree_size, sizeof(long));
+    reuse_time = 0;
+    block_map_init(&reuse_last, 1024);
+}
+
+void iplc_sim_reuse_tree_add(long pos, long delta)
+{
+    for (; pos < reuse_tree_size; pos += pos & -pos)
+        reuse_tree[pos] += delta;
+}
+
 /*
- * Don't touch this function.  It is for parsing the instruction stream.
+ * Number of blocks whose most recent access happened at or before pos.
  */
-unsigned int iplc_sim_parse_reg(char *reg_str)
+long iplc_sim_reuse_tree_sum(long pos)
 {
-    int i;
-    // turn comma into \n
-    if (reg_str[strlen(reg_str)-1] == ',')
-        reg_str[strlen(reg_str)-1] = '\n';
+    long sum = 0;
     
-    if (reg_str[0] != '$')
-        return atoi(reg_str);
-    else {
-        // copy down over $ character than return atoi
-        for (i = 0; i < strlen(reg_str); i++)
-            reg_str[i] = reg_str[i+1];
-        
-        return atoi(reg_str);
-    }
+    for (; pos > 0; pos -= pos & -pos)
+        sum += reuse_tree[pos];
+    return sum;
+}
+
+int iplc_sim_reuse_compare(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
 }
 
 /*
- * Don't touch this function.  It is for parsing the instruction stream.
+ * Out of timestamps.  Only the relative order of each block's last access
+ * matters, so renumber the live blocks 1..n and rebuild the tree with room
+ * to spare.  Amortized this keeps every access O(log n) in distinct blocks
+ * rather than in trace length.
  */
-void iplc_sim_parse_instruction(char *buffer)
+void iplc_sim_reuse_compact()
 {
-    int instruction_hit = 0;
-    int i=0, j=0;
-    int src_reg=0;
-    int src_reg2=0;
-    int dest_reg=0;
-    char str_src_reg[16];
-    char str_src_reg2[16];
-    char str_dest_reg[16];
-    char str_constant[16];
+    long *order, n = 0, i;
+    unsigned int slot;
     
-    if (sscanf(buffer, "%x %s", &instruction_address, instruction ) != 2) {
-        printf("Malformed instruction \n");
-        exit(-1);
+    order = (long *)malloc(sizeof(long) * 2 * (reuse_last.count + 1));
+    for (slot = 0; slot <= reuse_last.mask; slot++) {
+        if (reuse_last.val[slot] != -1) {
+            order[2*n] = reuse_last.val[slot];
+            order[2*n+1] = reuse_last.key[slot];
+            n++;
+        }
     }
+    qsort(order, n, 2 * sizeof(long), iplc_sim_reuse_compare);
     
-    instruction_hit = iplc_sim_trap_address( instruction_address );
+    reuse_tree_size = 1 << 16;
+    while (reuse_tree_size < 4 * n)
+        reuse_tree_size <<= 1;
+    free(reuse_tree);
+    reuse_tree = (long *)calloc(reuse_tree_size, sizeof(long));
     
-    // if a MISS, then push current instruction thru pipeline
-    if (!instruction_hit) {
-        // need to subtract 1, since the stage is pushed once more for actual instruction processing
-        // also need to allow for a branch miss prediction during the fetch cache miss time -- by
-        // counting cycles this allows for these cycles to overlap and not doubly count.
-        
-        printf("INST MISS:\t Address 0x%x \n", instruction_address);
-        
-        for (i = pipeline_cycles, j = pipeline_cycles; i < j + CACHE_MISS_DELAY - 1; i++)
-            iplc_sim_push_pipeline_stage();
+    for (i = 0; i < n; i++) {
+        block_map_put(&reuse_last, (unsigned int) order[2*i+1], i + 1);
+        iplc_sim_reuse_tree_add(i + 1, 1);
     }
-    else
-        printf("INST HIT:\t Address 0x%x \n", instruction_address);
+    reuse_time = n;
+    free(order);
+}
+
+/*
+ * Called by iplc_sim_trap_address() for every access.  The reuse distance is
+ * the number of distinct blocks touched since this block was last touched;
+ * the tree holds a 1 at the last access time of every block, so that is a
+ * range count over (last, now).
+ */
+void iplc_sim_reuse_access(unsigned int address, int is_data)
+{
+    unsigned int block = address >> cache_blockoffsetbits;
+    long last, distance;
+    int bin = 0;
     
-    // Parse the Instruction
+    if (reuse_time + 1 >= reuse_tree_size)
+        iplc_sim_reuse_compact();
+    reuse_time++;
     
-    if (strncmp( instruction, "add", 3 ) == 0 ||
-        strncmp( instruction, "sll", 3 ) == 0 ||
-        strncmp( instruction, "ori", 3 ) == 0) {
-        if (sscanf(buffer, "%x %s %s %s %s",
-                   &instruction_address,
-                   instruction,
-                   str_dest_reg,
-                   str_src_reg,
-                   str_src_reg2 ) != 5) {
-            printf("Malformed RTYPE instruction (%s) at address 0x%x \n",
-                   instruction, instruction_address);
-            exit(-1);
+    last = block_map_get(&reuse_last, block);
+    if (last == -1)
+        reuse_cold[is_data]++;
+    else {
+        distance = iplc_sim_reuse_tree_sum(reuse_time - 1) - iplc_sim_reuse_tree_sum(last);
+        // bin 0 holds distance 0, bin k holds [2^(k-1), 2^k)
+        while (distance) {
+            bin++;
+            distance >>= 1;
         }
-        
-        dest_reg = iplc_sim_parse_reg(str_dest_reg);
-        src_reg = iplc_sim_parse_reg(str_src_reg);
-        src_reg2 = iplc_sim_parse_reg(str_src_reg2);
-        
-        iplc_sim_process_pipeline_rtype(instruction, dest_reg, src_reg, src_reg2);
+        reuse_hist[is_data][bin]++;
+        iplc_sim_reuse_tree_add(last, -1);
     }
     
-    else if (strncmp( instruction, "lui", 3 ) == 0) {
-        if (sscanf(buffer, "%x %s %s %s",
-                   &instruction_address,
-                   instruction,
-                   str_dest_reg,
-                   str_constant ) != 4 ) {
-            printf("Malformed RTYPE instruction (%s) at address 0x%x \n",
-                   instruction, instruction_address );
-            exit(-1);
+    iplc_sim_reuse_tree_add(reuse_time, 1);
+    block_map_put(&reuse_last, block, reuse_time);
+}
+
+/*
+ * A fully associative LRU cache of C blocks misses exactly on the cold
+ * accesses and those with distance >= C, so at power of two sizes the
+ * histogram gives the miss curve directly.
+ */
+void iplc_sim_reuse_report()
+{
+    long total[2] = {0, 0}, misses;
+    int bin, top = 0, s;
+    
+    for (s = 0; s < 2; s++) {
+        total[s] = reuse_cold[s];
+        for (bin = 0; bin < REUSE_BINS; bin++) {
+            total[s] += reuse_hist[s][bin];
+            if (reuse_hist[s][bin])
+                top = bin;
         }
-        
-        dest_reg = iplc_sim_parse_reg(str_dest_reg);
-        src_reg = -1;
-        src_reg2 = -1;
-        iplc_sim_process_pipeline_rtype(instruction, dest_reg, src_reg, src_reg2);
     }
     
-    else if (strncmp( instruction, "lw", 2 ) == 0 ||
-             strncmp( instruction, "sw", 2 ) == 0  ) {
-        if ( sscanf( buffer, "%x %s %s %s %x",
-                    &instruction_address,
-                    instruction,
-                    reg1,
-                    offsetwithreg,
-                    &data_address ) != 5) {
-            printf("Bad instruction: %s at address %x \n", instruction, instruction_address);
-            exit(-1);
-        }
+    printf(" Reuse Distance Histogram (blocks) \n");
+    printf("\t %-24s %12s %12s \n", "Distance", "Inst", "Data");
+    for (bin = 0; bin <= top; bin++) {
+        char range[32];
         
-        if (strncmp(instruction, "lw", 2 ) == 0) {
-            
-            dest_reg = iplc_sim_parse_reg(reg1);
-            
-            // don't need to worry about base regs -- just insert -1 values
-            iplc_sim_process_pipeline_lw(dest_reg, -1, data_address);
-        }
-        if (strncmp( instruction, "sw", 2 ) == 0) {
-            src_reg = iplc_sim_parse_reg(reg1);
-            
-            // don't need to worry about base regs -- just insert -1 values
-            iplc_sim_process_pipeline_sw( src_reg, -1, data_address);
-        }
+        if (bin == 0)
+            sprintf(range, "0");
+        else if (bin == 1)
+            sprintf(range, "1");
+        else
+            sprintf(range, "%ld-%ld", 1L << (bin - 1), (1L << bin) - 1);
+        printf("\t %-24s %12ld %12ld \n", range, reuse_hist[0][bin], reuse_hist[1][bin]);
     }
-    else if (strncmp( instruction, "beq", 3 ) == 0) {
-        // don't need to worry about getting regs -- just insert -1 values
-        iplc_sim_process_pipeline_branch(-1, -1);
+    printf("\t %-24s %12ld %12ld \n\n", "cold", reuse_cold[0], reuse_cold[1]);
+    
+    printf(" Fully Associative LRU Miss Curve \n");
+    printf("\t %-24s %12s %12s \n", "Blocks", "Misses", "Miss Rate");
+    for (bin = 0; bin <= top + 1; bin++) {
+        misses = reuse_cold[0] + reuse_cold[1];
+        for (s = 0; s < 2; s++) {
+            int b;
+            for (b = bin + 1; b < REUSE_BINS; b++)
+                misses += reuse_hist[s][b];
+        }
+        printf("\t %-24ld %12ld %12f \n", 1L << bin, misses,
+               (double)misses / (double)(total[0] + total[1]));
     }
-    else if (strncmp( instruction, "jal", 3 ) == 0 ||
-             strncmp( instruction, "jr", 2 ) == 0 ||
-             strncmp( instruction, "j", 1 ) == 0 ) {
-        iplc_sim_process_pipeline_jump( instruction );
+    printf("\n");
+}
+
+/*
+ * Just output our summary statistics.
+ */
+void iplc_sim_finalize()
+{
+    iplc_sim_drain_pipeline();
+    if (timeline_file)
+        iplc_sim_timeline_close();
+    
+    printf(" Cache Performance \n");
+    printf("\t Number of Cache Accesses is %ld \n", cache_access);
+    printf("\t Number of Cache Misses is %ld \n", cache_miss);
+    printf("\t Number of Cache Hits is %ld \n", cache_hit);
+    printf("\t Cache Miss Rate is %f \n\n", (double)cache_miss / (double)cache_access);
+    if (victim_entries) {
+        printf(" Victim Cache Performance \n");
+        printf("\t Victim Cache Entries is %d \n", victim_entries);
+        printf("\t Number of Victim Cache Hits is %ld \n", victim_hit);
+        printf("\t Victim Hit Rate is %f \n", (double)victim_hit / (double)cache_miss);
+        printf("\t Effective Miss Rate is %f \n\n",
+               (double)(cache_miss - victim_hit) / (double)cache_access);
     }
-    else if (strncmp( instruction, "jal", 3 ) == 0 ||
-             strncmp( instruction, "jr", 2 ) == 0 ||
-             strncmp( instruction, "j", 1 ) == 0 ) {
-        /*
-         * Note: no need to worry about forwarding on the jump register
-         * we'll let that one go.
-         */
-        iplc_sim_process_pipeline_jump(instruction);
+    if (dram_enabled)
+        iplc_sim_dram_report();
+    if (tlb_enabled)
+        iplc_sim_tlb_report();
+    if (classify_misses) {
+        printf(" Miss Classification \n");
+        printf("\t Compulsory Misses is %ld \n", cache_miss_compulsory);
+        printf("\t Capacity Misses is %ld \n", cache_miss_capacity);
+        printf("\t Conflict Misses is %ld \n\n", cache_miss_conflict);
     }
-    else if ( strncmp( instruction, "syscall", 7 ) == 0) {
-        iplc_sim_process_pipeline_syscall( );
+    if (reuse_profile)
+        iplc_sim_reuse_report();
+    if (func_mode) {
+        printf(" Functional Front-End \n");
+        printf("\t Instructions Executed is %ld \n\n", func_executed);
     }
-    else if ( strncmp( instruction, "nop", 3 ) == 0) {
-        iplc_sim_process_pipeline_nop( );
+    if (loop_mode) {
+        printf(" Loop Extrapolation \n");
+        printf("\t Iterations Extrapolated is %ld \n", loop_iterations);
+        printf("\t Trace Lines Skipped is %ld \n\n", loop_skipped);
     }
-    else {
-        printf("Do not know how to process instruction: %s at address %x \n",
-               instruction, instruction_address );
-        exit(-1);
+    if (block_mode) {
+        printf(" Basic Block Mode \n");
+        printf("\t Same Block Fetch Hits is %ld \n", fast_hits);
+        printf("\t Instructions Retired in Bulk is %ld \n\n", block_bulk);
     }
+    printf("Pipeline Performance \n");
+    printf("\t Total Cycles is %u \n", pipeline_cycles);
+    printf("\t Total Instructions is %u \n", instruction_count);
+    printf("\t Total Branch Instructions is %u \n", branch_count);
+    printf("\t Total Correct Branch Predictions is %u \n", correct_branch_predictions);
+    printf("\t CPI is %f \n\n", (double)pipeline_cycles / (double)instruction_count);
+    
+    if (results_format != RESULTS_NONE)
+        iplc_sim_results_write();
 }
 
 /************************************************************************************************/
-/* MAIN Function ********************************************************************************/
+/* TLB Functions ********************************************************************************/
 /************************************************************************************************/
 
-int main()
+/*
+ * With -V, trace addresses are virtual.  Instruction fetches go through
+ * the I-TLB and data accesses through the D-TLB, with a shared L2 TLB
+ * behind both and a page walk behind that.  All of them are LRU.  Frames
+ * are handed out on first touch: seq numbers them in order, hash
+ * scatters them over physical memory, and identity keeps the virtual
+ * address.
+ *
+ * PIPT caches index and tag with the physical address, and even an L1 TLB
+ * hit costs l1hit cycles ahead of the cache.  VIPT caches take their
+ * index bits from the virtual address and look the TLB up alongside, so
+ * only TLB misses cost anything.  Once the index runs past the page offset
+ * the two choose different sets.
+ */
+
+/*
+ * Parse a list such as "itlb=16,dtlb=32,l2tlb=512:4,page=4096,walk=30".
+ */
+void iplc_sim_tlb_configure(char *spec)
 {
-    char trace_file_name[1024];
-    FILE *trace_file = NULL;
-    char buffer[80];
-    int index = 10;
-    int blocksize = 1;
-    int assoc = 1;
+    char *opt, key[32], value[32];
+    
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (sscanf(opt, "%31[^=]=%31s", key, value) != 2) {
+            printf("Unknown TLB option: %s \n", opt);
+            exit(-1);
+        }
+        
+        if (strcmp(key, "itlb") == 0)
+            itlb.ways = atoi(value);
+        else if (strcmp(key, "dtlb") == 0)
+            dtlb.ways = atoi(value);
+        else if (strcmp(key, "l2tlb") == 0 &&
+                 sscanf(value, "%d:%d", &l2tlb.sets, &l2tlb.ways) == 2)
+            l2tlb.sets /= l2tlb.ways > 0 ? l2tlb.ways : 1;
+        else if (strcmp(key, "page") == 0)
+            tlb_page_bytes = atoi(value);
+        else if (strcmp(key, "l1hit") == 0)
+            tlb_l1_delay = atoi(value);
+        else if (strcmp(key, "l2hit") == 0)
+            tlb_l2_delay = atoi(value);
+        else if (strcmp(key, "walk") == 0)
+            tlb_walk_delay = atoi(value);
+        else if (strcmp(key, "index") == 0 && strcmp(value, "vipt") == 0)
+            tlb_pipt = 0;
+        else if (strcmp(key, "index") == 0 && strcmp(value, "pipt") == 0)
+            tlb_pipt = 1;
+        else if (strcmp(key, "map") == 0 && strcmp(value, "seq") == 0)
+            tlb_map = TLB_MAP_SEQ;
+        else if (strcmp(key, "map") == 0 && strcmp(value, "hash") == 0)
+            tlb_map = TLB_MAP_HASH;
+        else if (strcmp(key, "map") == 0 && strcmp(value, "identity") == 0)
+            tlb_map = TLB_MAP_IDENTITY;
+        else {
+            printf("Unknown TLB option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    
+    tlb_page_bits = (int) rint((log( (double) tlb_page_bytes )/ log(2)));
+    if (itlb.ways < 1 || dtlb.ways < 1 || l2tlb.ways < 1 || l2tlb.sets < 1 ||
+        (l2tlb.sets & (l2tlb.sets - 1)) != 0 || tlb_page_bytes != (1 << tlb_page_bits) ||
+        tlb_page_bits < 10 || tlb_page_bits > 24) {
+        printf("Bad TLB configuration \n");
+        exit(-1);
+    }
+    itlb.sets = dtlb.sets = 1;
+    tlb_enabled = 1;
+}
+
+void iplc_sim_tlb_build(tlb_t *tlb)
+{
+    free(tlb->vpn);
+    free(tlb->stamp);
+    tlb->vpn = (unsigned int *)calloc(tlb->sets * tlb->ways, sizeof(unsigned int));
+    tlb->stamp = (unsigned long *)calloc(tlb->sets * tlb->ways, sizeof(unsigned long));
+    tlb->access = 0;
+    tlb->miss = 0;
+}
+
+void iplc_sim_tlb_init()
+{
+    iplc_sim_tlb_build(&itlb);
+    iplc_sim_tlb_build(&dtlb);
+    iplc_sim_tlb_build(&l2tlb);
+    if (tlb_frames.key) {
+        free(tlb_frames.key);
+        free(tlb_frames.val);
+    }
+    block_map_init(&tlb_frames, 1024);
+    tlb_clock = 0;
+    tlb_walks = 0;
+    tlb_cycles = 0;
+}
+
+/*
+ * Look a page up, filling it over the least recently used way on a miss.
+ */
+int iplc_sim_tlb_lookup(tlb_t *tlb, unsigned int vpn)
+{
+    unsigned int set = vpn & (tlb->sets - 1);
+    unsigned int *way_vpn = &tlb->vpn[set * tlb->ways];
+    unsigned long *way_stamp = &tlb->stamp[set * tlb->ways];
+    int i, lru = 0;
+    
+    tlb->access++;
+    for (i = 0; i < tlb->ways; i++) {
+        if (way_vpn[i] == vpn + 1) {
+            way_stamp[i] = ++tlb_clock;
+            return 1;
+        }
+        if (way_stamp[i] < way_stamp[lru])
+            lru = i;
+    }
+    tlb->miss++;
+    way_vpn[lru] = vpn + 1;       // stored plus one so 0 is an empty way
+    way_stamp[lru] = ++tlb_clock;
+    return 0;
+}
+
+/*
+ * Frame of a virtual page, given one the first time the page is touched.
+ */
+unsigned int iplc_sim_tlb_frame(unsigned int vpn)
+{
+    long frame = block_map_get(&tlb_frames, vpn);
+    unsigned int mask = (1U << (32 - tlb_page_bits)) - 1;
+    
+    if (frame >= 0)
+        return (unsigned int) frame;
+    
+    frame = tlb_frames.count;
+    if (tlb_map == TLB_MAP_IDENTITY)
+        frame = vpn;
+    else if (tlb_map == TLB_MAP_HASH) {
+        // odd multiply and xorshift are both one to one on the frame bits
+        frame = (frame * 0x9e3779b1U) & mask;
+        frame ^= frame >> 7;
+        frame = (frame * 0x85ebca6bU) & mask;
+    }
+    block_map_put(&tlb_frames, vpn, frame);
+    return (unsigned int) frame;
+}
+
+/*
+ * Translate an access, charging its cycles, and return the address the
+ * cache should see.
+ */
+unsigned int iplc_sim_tlb_translate(unsigned int address, int is_data)
+{
+    unsigned int vpn = address >> tlb_page_bits;
+    unsigned int physical, index_bits;
+    unsigned int cycles = tlb_pipt ? tlb_l1_delay : 0;
+    
+    if (!iplc_sim_tlb_lookup(is_data ? &dtlb : &itlb, vpn)) {
+        cycles += tlb_l2_delay;
+        if (!iplc_sim_tlb_lookup(&l2tlb, vpn)) {
+            cycles += tlb_walk_delay;
+            tlb_walks++;
+        }
+    }
+    
+    physical = (iplc_sim_tlb_frame(vpn) << tlb_page_bits) | (address & (tlb_page_bytes - 1));
+    if (!tlb_pipt) {
+        index_bits = ((1U << cache_index) - 1) << cache_blockoffsetbits;
+        physical = (physical & ~index_bits) | (address & index_bits);
+    }
+    
+    if (cycles) {
+        if (timeline_file)
+            iplc_sim_timeline_stall(is_data ? "dtlb" : "itlb", pipeline_cycles, cycles,
+                                    is_data ? pipeline[MEM].instruction_address : address, address);
+        pipeline_cycles += cycles;
+        tlb_cycles += cycles;
+    }
+    return physical;
+}
+
+void iplc_sim_tlb_report()
+{
+    printf(" TLB Performance \n");
+    printf("\t Page Size is %d bytes, %s, %s frames \n", tlb_page_bytes, tlb_pipt ? "PIPT" : "VIPT",
+           tlb_map == TLB_MAP_SEQ ? "sequential" : tlb_map == TLB_MAP_HASH ? "hashed" : "identity");
+    printf("\t I-TLB Entries is %d, Misses is %ld, Miss Rate is %f \n", itlb.ways, itlb.miss,
+           itlb.access ? (double)itlb.miss / (double)itlb.access : 0.0);
+    printf("\t D-TLB Entries is %d, Misses is %ld, Miss Rate is %f \n", dtlb.ways, dtlb.miss,
+           dtlb.access ? (double)dtlb.miss / (double)dtlb.access : 0.0);
+    printf("\t L2 TLB Entries is %d (%d way), Misses is %ld, Miss Rate is %f \n",
+           l2tlb.sets * l2tlb.ways, l2tlb.ways, l2tlb.miss,
+           l2tlb.access ? (double)l2tlb.miss / (double)l2tlb.access : 0.0);
+    printf("\t Page Walks is %ld \n", tlb_walks);
+    printf("\t Pages Touched is %u \n", tlb_frames.count);
+    printf("\t Translation Cycles is %ld \n", tlb_cycles);
+    printf("\t Translation CPI is %f \n\n",
+           instruction_count ? (double)tlb_cycles / (double)instruction_count : 0.0);
+}
+
+/************************************************************************************************/
+/* Pipeline Functions ***************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Dump the contents of a pipeline as it was at the given cycle.
+ */
+void iplc_sim_dump_stages(unsigned int cycle, pipeline_t *stage)
+{
+    int i;
+    
+    for (i = 0; i < MAX_STAGES; i++) {
+        switch(i) {
+            case FETCH:
+                printf("(cyc: %u) FETCH:\t %d: 0x%x \t", cycle, stage[i].itype, stage[i].instruction_address);
+                break;
+            case DECODE:
+                printf("DECODE:\t %d: 0x%x \t", stage[i].itype, stage[i].instruction_address);
+                break;
+            case ALU:
+                printf("ALU:\t %d: 0x%x \t", stage[i].itype, stage[i].instruction_address);
+                break;
+            case MEM:
+                printf("MEM:\t %d: 0x%x \t", stage[i].itype, stage[i].instruction_address);
+                break;
+            case WRITEBACK:
+                printf("WB:\t %d: 0x%x \n", stage[i].itype, stage[i].instruction_address);
+                break;
+            default:
+                printf("DUMP: Bad stage!\n" );
+                exit(-1);
+        }
+    }
+}
+
+/*
+ * Dump the current contents of our pipeline.
+ */
+void iplc_sim_dump_pipeline()
+{
+    iplc_sim_dump_stages(pipeline_cycles, pipeline);
+}
+
+/*
+ * Check if various stages of our pipeline require stalls, forwarding, etc.
+ * Then push the contents of our various pipeline stages through the pipeline.
+ */
+void iplc_sim_push_pipeline_stage()
+{
+    int data_hit=1;
+    
+    if (profile_enabled)
+        iplc_sim_profile_enter(PROFILE_PUSH);
+    
+    /* 1. Count WRITEBACK stage is "retired" -- This I'm giving you */
+    if (pipeline[WRITEBACK].instruction_address) {
+        instruction_count++;
+        if (debug)
+            printf("DEBUG: Retired Instruction at 0x%x, Type %d, at Time %u \n",
+                   pipeline[WRITEBACK].instruction_address, pipeline[WRITEBACK].itype, pipeline_cycles);
+    }
+    
+    /* 2. Check for BRANCH and correct/incorrect Branch Prediction */
+    if (pipeline[DECODE].itype == BRANCH) {
+        int branch_taken = 0;
+        
+        branch_count++;
+        
+        // taken if the next fetched instruction is not the fall-through address
+        if (pipeline[FETCH].instruction_address &&
+            pipeline[FETCH].instruction_address != pipeline[DECODE].instruction_address + 4) {
+            branch_taken = 1;
+            if (trace_output)
+                printf("DEBUG: Branch Taken: FETCH addr = 0x%x, DECODE instr addr = 0x%x \n",
+                       pipeline[FETCH].instruction_address, pipeline[DECODE].instruction_address);
+        }
+        
+        if (branch_taken == branch_predict_taken)
+            correct_branch_predictions++;
+        else {
+            if (timeline_file)
+                iplc_sim_timeline_stall("mispredict", pipeline_cycles, 1,
+                                        pipeline[DECODE].instruction_address, 0);
+            pipeline_cycles++; // flush the wrong-path fetch
+            if (trigger_mode)
+                iplc_sim_trigger_event(TRIGGER_MISPREDICT, pipeline[DECODE].instruction_address);
+        }
+    }
+    
+    /* 3. Check for LW delays due to use in ALU stage and if data hit/miss
+     *    add delay cycles if needed.
+     */
+    if (pipeline[MEM].itype == LW) {
+        int inserted_nop = 0;
+        
+        access_is_data = 1;
+        data_hit = iplc_sim_trap_address(tlb_enabled ?
+                                         iplc_sim_tlb_translate(pipeline[MEM].stage.lw.data_address, 1) :
+                                         pipeline[MEM].stage.lw.data_address);
+        access_is_data = 0;
+        if (!data_hit) {
+            // the MEM stage already accounts for one of the miss cycles
+            if (trace_output)
+                printf("DATA MISS:\t Address 0x%x \n", pipeline[MEM].stage.lw.data_address);
+            if (timeline_file)
+                iplc_sim_timeline_stall("data miss", pipeline_cycles, miss_delay - 1,
+                                        pipeline[MEM].instruction_address,
+                                        pipeline[MEM].stage.lw.data_address);
+            pipeline_cycles += miss_delay - 1;
+        }
+        else if (trace_output)
+            printf("DATA HIT:\t Address 0x%x \n", pipeline[MEM].stage.lw.data_address);
+        
+        // loaded value cannot be forwarded to an ALU op in the same cycle
+        if (pipeline[ALU].itype == RTYPE) {
+            int dest_reg = pipeline[MEM].stage.lw.dest_reg;
+            int immediate = 0;
+            
+            // the second operand of these is a constant, not a register
+            if (strncmp(pipeline[ALU].stage.rtype.instruction, "addi", 4) == 0 ||
+                strncmp(pipeline[ALU].stage.rtype.instruction, "ori", 3) == 0 ||
+                strncmp(pipeline[ALU].stage.rtype.instruction, "sll", 3) == 0)
+                immediate = 1;
+            
+            if (pipeline[ALU].stage.rtype.reg1 == dest_reg ||
+                (!immediate && pipeline[ALU].stage.rtype.reg2_or_constant == dest_reg))
+                inserted_nop = 1;
+        }
+        
+        if (inserted_nop) {
+            if (debug)
+                printf("DEBUG: LW STALL due to use in ALU stage at instruction 0x%x \n",
+                       pipeline[ALU].instruction_address);
+            if (timeline_file)
+                iplc_sim_timeline_stall("load use", pipeline_cycles, 1, pipeline[ALU].instruction_address, 0);
+            pipeline_cycles++;
+            if (trigger_mode)
+                iplc_sim_trigger_event(TRIGGER_STALL, pipeline[ALU].instruction_address);
+        }
+    }
+    
+    /* 4. Check for SW mem acess and data miss .. add delay cycles if needed */
+    if (pipeline[MEM].itype == SW) {
+        access_is_data = 1;
+        access_is_write = 1;
+        data_hit = iplc_sim_trap_address(tlb_enabled ?
+                                         iplc_sim_tlb_translate(pipeline[MEM].stage.sw.data_address, 1) :
+                                         pipeline[MEM].stage.sw.data_address);
+        access_is_data = 0;
+        access_is_write = 0;
+        if (!data_hit) {
+            unsigned int delay = miss_delay - 1;
+            
+            // the memory controller takes the fill, the store only waits for a queue slot
+            if (dram_enabled && !warming)
+                delay = dram_wait;
+            if (trace_output)
+                printf("DATA MISS:\t Address 0x%x \n", pipeline[MEM].stage.sw.data_address);
+            if (timeline_file && delay)
+                iplc_sim_timeline_stall("data miss", pipeline_cycles, delay,
+                                        pipeline[MEM].instruction_address,
+                                        pipeline[MEM].stage.sw.data_address);
+            pipeline_cycles += delay;
+        }
+        else if (trace_output)
+            printf("DATA HIT:\t Address 0x%x \n", pipeline[MEM].stage.sw.data_address);
+    }
+    
+    /* 5. Increment pipe_cycles 1 cycle for normal processing */
+    pipeline_cycles++;
+    
+    if (timeline_file)
+        iplc_sim_timeline_push();
+    
+    /* 6. push stages thru MEM->WB, ALU->MEM, DECODE->ALU, FETCH->ALU */
+    pipeline[WRITEBACK] = pipeline[MEM];
+    pipeline[MEM] = pipeline[ALU];
+    pipeline[ALU] = pipeline[DECODE];
+    pipeline[DECODE] = pipeline[FETCH];
+    
+    // 7. This is a give'me -- Reset the FETCH stage to NOP via bezero */
+    bzero(&(pipeline[FETCH]), sizeof(pipeline_t));
+    
+    if (profile_enabled)
+        iplc_sim_profile_exit();
+}
+
+/*
+ * Finish processing all instructions in the Pipeline.
+ */
+void iplc_sim_drain_pipeline()
+{
+    iplc_sim_block_flush();
+    while (pipeline[FETCH].itype != NOP  ||
+           pipeline[DECODE].itype != NOP ||
+           pipeline[ALU].itype != NOP    ||
+           pipeline[MEM].itype != NOP    ||
+           pipeline[WRITEBACK].itype != NOP) {
+        iplc_sim_push_pipeline_stage();
+    }
+}
+
+/*
+ * This function is fully implemented.  You should use this as a reference
+ * for implementing the remaining instruction types.
+ */
+void iplc_sim_process_pipeline_rtype(char *instruction, int dest_reg, int reg1, int reg2_or_constant)
+{
+    /* This is an example of what you need to do for the rest */
+    iplc_sim_push_pipeline_stage();
+    
+    pipeline[FETCH].itype = RTYPE;
+    pipeline[FETCH].instruction_address = instruction_address;
+    
+    strcpy(pipeline[FETCH].stage.rtype.instruction, instruction);
+    pipeline[FETCH].stage.rtype.reg1 = reg1;
+    pipeline[FETCH].stage.rtype.reg2_or_constant = reg2_or_constant;
+    pipeline[FETCH].stage.rtype.dest_reg = dest_reg;
+}
+
+void iplc_sim_process_pipeline_lw(int dest_reg, int base_reg, unsigned int data_address)
+{
+    iplc_sim_push_pipeline_stage();
+    
+    pipeline[FETCH].itype = LW;
+    pipeline[FETCH].instruction_address = instruction_address;
+    
+    pipeline[FETCH].stage.lw.data_address = data_address;
+    pipeline[FETCH].stage.lw.dest_reg = dest_reg;
+    pipeline[FETCH].stage.lw.base_reg = base_reg;
+}
+
+void iplc_sim_process_pipeline_sw(int src_reg, int base_reg, unsigned int data_address)
+{
+    iplc_sim_push_pipeline_stage();
+    
+    pipeline[FETCH].itype = SW;
+    pipeline[FETCH].instruction_address = instruction_address;
+    
+    pipeline[FETCH].stage.sw.data_address = data_address;
+    pipeline[FETCH].stage.sw.src_reg = src_reg;
+    pipeline[FETCH].stage.sw.base_reg = base_reg;
+}
+
+void iplc_sim_process_pipeline_branch(int reg1, int reg2)
+{
+    iplc_sim_push_pipeline_stage();
+    
+    pipeline[FETCH].itype = BRANCH;
+    pipeline[FETCH].instruction_address = instruction_address;
+    
+    pipeline[FETCH].stage.branch.reg1 = reg1;
+    pipeline[FETCH].stage.branch.reg2 = reg2;
+}
+
+void iplc_sim_process_pipeline_jump(char *instruction)
+{
+    iplc_sim_push_pipeline_stage();
+    
+    pipeline[FETCH].itype = JUMP;
+    pipeline[FETCH].instruction_address = instruction_address;
+    
+    strcpy(pipeline[FETCH].stage.jump.instruction, instruction);
+}
+
+void iplc_sim_process_pipeline_syscall()
+{
+    iplc_sim_push_pipeline_stage();
+    
+    pipeline[FETCH].itype = SYSCALL;
+    pipeline[FETCH].instruction_address = instruction_address;
+}
+
+void iplc_sim_process_pipeline_nop()
+{
+    iplc_sim_push_pipeline_stage();
+    
+    pipeline[FETCH].itype = NOP;
+    pipeline[FETCH].instruction_address = instruction_address;
+}
+
+/************************************************************************************************/
+/* parse Function *******************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Don't touch this function.  It is for parsing the instruction stream.
+ */
+unsigned int iplc_sim_parse_reg(char *reg_str)
+{
+    int i;
+    // turn comma into \n
+    if (reg_str[strlen(reg_str)-1] == ',')
+        reg_str[strlen(reg_str)-1] = '\n';
+    
+    if (reg_str[0] != '$')
+        return atoi(reg_str);
+    else {
+        // copy down over $ character than return atoi
+        for (i = 0; i < strlen(reg_str); i++)
+            reg_str[i] = reg_str[i+1];
+        
+        return atoi(reg_str);
+    }
+}
+
+/*
+ * Turn one trace line into a decoded_instruction_t.  Malformed lines stop
+ * the run, as they always have.
+ */
+void iplc_sim_decode_instruction(char *buffer, decoded_instruction_t *decoded)
+{
+    char str_src_reg[16];
+    char str_src_reg2[16];
+    char str_dest_reg[16];
+    char str_constant[16];
+    
+    bzero(decoded, sizeof(decoded_instruction_t));
+    
+    if (sscanf(buffer, "%x %15s", &instruction_address, instruction ) != 2) {
+        printf("Malformed instruction \n");
+        exit(-1);
+    }
+    decoded->instruction_address = instruction_address;
+    strcpy(decoded->instruction, instruction);
+    
+    // Parse the Instruction
+    
+    if (strncmp( instruction, "add", 3 ) == 0 ||
+        strncmp( instruction, "sll", 3 ) == 0 ||
+        strncmp( instruction, "ori", 3 ) == 0) {
+        if (sscanf(buffer, "%x %15s %15s %15s %15s",
+                   &instruction_address,
+                   instruction,
+                   str_dest_reg,
+                   str_src_reg,
+                   str_src_reg2 ) != 5) {
+            printf("Malformed RTYPE instruction (%s) at address 0x%x \n",
+                   instruction, instruction_address);
+            exit(-1);
+        }
+        
+        decoded->itype = RTYPE;
+        decoded->dest_reg = iplc_sim_parse_reg(str_dest_reg);
+        decoded->reg1 = iplc_sim_parse_reg(str_src_reg);
+        decoded->reg2 = iplc_sim_parse_reg(str_src_reg2);
+    }
+    
+    else if (strncmp( instruction, "lui", 3 ) == 0) {
+        if (sscanf(buffer, "%x %15s %15s %15s",
+                   &instruction_address,
+                   instruction,
+                   str_dest_reg,
+                   str_constant ) != 4 ) {
+            printf("Malformed RTYPE instruction (%s) at address 0x%x \n",
+                   instruction, instruction_address );
+            exit(-1);
+        }
+        
+        decoded->itype = RTYPE;
+        decoded->dest_reg = iplc_sim_parse_reg(str_dest_reg);
+        decoded->reg1 = -1;
+        decoded->reg2 = -1;
+    }
+    
+    else if (strncmp( instruction, "lw", 2 ) == 0 ||
+             strncmp( instruction, "sw", 2 ) == 0  ) {
+        if ( sscanf( buffer, "%x %15s %15s %15s %x",
+                    &instruction_address,
+                    instruction,
+                    reg1,
+                    offsetwithreg,
+                    &data_address ) != 5) {
+            printf("Bad instruction: %s at address %x \n", instruction, instruction_address);
+            exit(-1);
+        }
+        
+        // don't need to worry about base regs -- just insert -1 values
+        decoded->itype = strncmp(instruction, "lw", 2) == 0 ? LW : SW;
+        decoded->dest_reg = iplc_sim_parse_reg(reg1);
+        decoded->reg1 = -1;
+        decoded->data_address = data_address;
+    }
+    else if (strncmp( instruction, "beq", 3 ) == 0) {
+        // don't need to worry about getting regs -- just insert -1 values
+        decoded->itype = BRANCH;
+        decoded->reg1 = -1;
+        decoded->reg2 = -1;
+    }
+    else if (strncmp( instruction, "jal", 3 ) == 0 ||
+             strncmp( instruction, "jr", 2 ) == 0 ||
+             strncmp( instruction, "j", 1 ) == 0 ) {
+        /*
+         * Note: no need to worry about forwarding on the jump register
+         * we'll let that one go.
+         */
+        decoded->itype = JUMP;
+    }
+    else if ( strncmp( instruction, "syscall", 7 ) == 0) {
+        decoded->itype = SYSCALL;
+    }
+    else if ( strncmp( instruction, "nop", 3 ) == 0) {
+        decoded->itype = NOP;
+    }
+    else {
+        printf("Do not know how to process instruction: %s at address %x \n",
+               instruction, instruction_address );
+        exit(-1);
+    }
+}
+
+/*
+ * Fetch a decoded instruction through the cache and start it down the
+ * pipeline.
+ */
+void iplc_sim_execute_instruction(decoded_instruction_t *decoded)
+{
+    int instruction_hit = 0;
+    int i=0, j=0;
+    unsigned int delay;
+    
+    if (block_mode) {
+        if (iplc_sim_block_eligible(decoded)) {
+            iplc_sim_block_queue(decoded);
+            return;
+        }
+        iplc_sim_block_flush();
+    }
+    
+    instruction_address = decoded->instruction_address;
+    
+    instruction_hit = iplc_sim_trap_address(tlb_enabled ?
+                                            iplc_sim_tlb_translate(instruction_address, 0) :
+                                            instruction_address);
+    if (block_mode)
+        iplc_sim_block_track(decoded, instruction_hit);
+    
+    // if a MISS, then push current instruction thru pipeline
+    if (!instruction_hit) {
+        // need to subtract 1, since the stage is pushed once more for actual instruction processing
+        // also need to allow for a branch miss prediction during the fetch cache miss time -- by
+        // counting cycles this allows for these cycles to overlap and not doubly count.
+        
+        if (trace_output)
+            printf("INST MISS:\t Address 0x%x \n", instruction_address);
+        
+        // a data miss while the fetch is stalled sets miss_delay again
+        delay = miss_delay;
+        for (i = pipeline_cycles, j = pipeline_cycles; i < j + delay - 1; i++)
+            iplc_sim_push_pipeline_stage();
+        if (timeline_file)
+            iplc_sim_timeline_stall("inst miss", j, pipeline_cycles - j, instruction_address, 0);
+    }
+    else if (trace_output)
+        printf("INST HIT:\t Address 0x%x \n", instruction_address);
+    
+    switch (decoded->itype) {
+        case RTYPE:
+            iplc_sim_process_pipeline_rtype(decoded->instruction, decoded->dest_reg,
+                                            decoded->reg1, decoded->reg2);
+            break;
+        case LW:
+            iplc_sim_process_pipeline_lw(decoded->dest_reg, decoded->reg1, decoded->data_address);
+            break;
+        case SW:
+            iplc_sim_process_pipeline_sw(decoded->dest_reg, decoded->reg1, decoded->data_address);
+            break;
+        case BRANCH:
+            iplc_sim_process_pipeline_branch(decoded->reg1, decoded->reg2);
+            break;
+        case JUMP:
+        case JAL:
+            iplc_sim_process_pipeline_jump(decoded->instruction);
+            break;
+        case SYSCALL:
+            iplc_sim_process_pipeline_syscall();
+            break;
+        default:
+            iplc_sim_process_pipeline_nop();
+            break;
+    }
+}
+
+void iplc_sim_parse_instruction(char *buffer)
+{
+    decoded_instruction_t decoded;
+    
+    if (profile_enabled)
+        iplc_sim_profile_enter(PROFILE_PARSE);
+    
+    iplc_sim_decode_instruction(buffer, &decoded);
+    iplc_sim_execute_instruction(&decoded);
+    
+    if (profile_enabled)
+        iplc_sim_profile_exit();
+}
+
+/************************************************************************************************/
+/* Basic Block Functions ************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Basic block mode (-b) retires runs of straight-line code in bulk.  Once
+ * the five instructions ahead of a fetch are ALU ops or nops that all hit
+ * in the cache, another such instruction in the block just fetched cannot
+ * stall, mispredict or touch data: its push only retires the instruction
+ * five ahead and costs one cycle, and its fetch is a hit on the MRU line.
+ * Those instructions are queued and settled together by
+ * iplc_sim_block_flush(), which leaves every counter and the pipeline
+ * exactly as one-at-a-time simulation would.
+ */
+int iplc_sim_block_eligible(decoded_instruction_t *decoded)
+{
+    unsigned int block = decoded->instruction_address >> cache_blockoffsetbits;
+    
+    return block_quiet >= MAX_STAGES &&
+           (decoded->itype == RTYPE || decoded->itype == NOP) &&
+           fast_valid && block == fast_block &&
+           cache[fast_index].assoc[fast_way].vb;
+}
+
+/*
+ * Track how many of the most recent instructions were straight-line hits.
+ */
+void iplc_sim_block_track(decoded_instruction_t *decoded, int instruction_hit)
+{
+    if (decoded->itype != RTYPE && decoded->itype != NOP)
+        block_quiet = 0;
+    else if (!instruction_hit)
+        block_quiet = 1;          // the bubbles went in ahead of it
+    else
+        block_quiet++;
+}
+
+void iplc_sim_block_queue(decoded_instruction_t *decoded)
+{
+    block_ring[block_pending % MAX_STAGES] = *decoded;
+    block_pending++;
+}
+
+/*
+ * Settle the queued instructions: one cycle, one retirement and one fetch
+ * hit each, then only the last five are still in the pipeline.
+ */
+void iplc_sim_block_flush()
+{
+    long k, first;
+    decoded_instruction_t *decoded;
+    
+    if (block_pending == 0)
+        return;
+    
+    pipeline_cycles += block_pending;
+    instruction_count += block_pending;
+    cache_access += block_pending;
+    cache_hit += block_pending;
+    block_bulk += block_pending;
+    
+    first = block_pending > MAX_STAGES ? block_pending - MAX_STAGES : 0;
+    for (k = first; k < block_pending; k++) {
+        decoded = &block_ring[k % MAX_STAGES];
+        pipeline[WRITEBACK] = pipeline[MEM];
+        pipeline[MEM] = pipeline[ALU];
+        pipeline[ALU] = pipeline[DECODE];
+        pipeline[DECODE] = pipeline[FETCH];
+        bzero(&(pipeline[FETCH]), sizeof(pipeline_t));
+        pipeline[FETCH].itype = decoded->itype;
+        pipeline[FETCH].instruction_address = decoded->instruction_address;
+        if (decoded->itype == RTYPE) {
+            strcpy(pipeline[FETCH].stage.rtype.instruction, decoded->instruction);
+            pipeline[FETCH].stage.rtype.reg1 = decoded->reg1;
+            pipeline[FETCH].stage.rtype.reg2_or_constant = decoded->reg2;
+            pipeline[FETCH].stage.rtype.dest_reg = decoded->dest_reg;
+        }
+        instruction_address = decoded->instruction_address;
+    }
+    block_pending = 0;
+}
+
+/************************************************************************************************/
+/* Loop Functions *******************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Loop mode (-L) treats the lines from a backward branch or jump target
+ * up to its next occurrence as one iteration.  If the cache, the pipeline
+ * and the fetch fast path are the same at both ends of an iteration, then
+ * any later iteration with the same trace lines, data addresses included,
+ * starts and ends in that state and adds the same counter deltas.  Such
+ * iterations are read and compared but not simulated.  The first line that
+ * differs drops back to detailed simulation of the partial iteration from
+ * the steady state, so the results are the same as a full run.
+ */
+
+/*
+ * Remember the state an iteration starting at head begins in.
+ */
+void iplc_sim_loop_start(unsigned int head)
+{
+    int i;
+    
+    if (loop_assoc == NULL) {
+        loop_assoc = (assoc_t *)malloc(sizeof(assoc_t) * (cache_assoc << cache_index));
+        loop_replacement = (int *)malloc(sizeof(int) * (cache_assoc << cache_index));
+    }
+    for (i = 0; i < (1<<cache_index); i++) {
+        memcpy(&loop_assoc[i * cache_assoc], cache[i].assoc, sizeof(assoc_t) * cache_assoc);
+        memcpy(&loop_replacement[i * cache_assoc], cache[i].replacement, sizeof(int) * cache_assoc);
+    }
+    memcpy(loop_pipeline, pipeline, sizeof(pipeline));
+    loop_fast_valid = fast_valid;
+    loop_fast_block = fast_block;
+    loop_fast_way = fast_way;
+    loop_block_quiet = block_quiet;
+    
+    iplc_sim_get_counters(&loop_counters);
+    loop_fast_hits = fast_hits;
+    loop_block_bulk = block_bulk;
+    
+    loop_head = head;
+    loop_lines = 0;
+}
+
+/*
+ * Is the state the same as when the iteration started?
+ */
+int iplc_sim_loop_steady()
+{
+    int i;
+    
+    if (memcmp(loop_pipeline, pipeline, sizeof(pipeline)) != 0 ||
+        loop_fast_valid != fast_valid || loop_fast_block != fast_block ||
+        loop_fast_way != fast_way || loop_block_quiet != block_quiet)
+        return 0;
+    for (i = 0; i < (1<<cache_index); i++) {
+        if (memcmp(&loop_assoc[i * cache_assoc], cache[i].assoc, sizeof(assoc_t) * cache_assoc) != 0 ||
+            memcmp(&loop_replacement[i * cache_assoc], cache[i].replacement, sizeof(int) * cache_assoc) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Simulate one line in detail, recording it as part of the iteration.
+ */
+void iplc_sim_loop_simulate(char *buffer)
+{
+    if (loop_lines >= 0 && loop_lines < MAX_LOOP_LINES)
+        strcpy(loop_body[loop_lines++], buffer);
+    else
+        loop_lines = -1;          // too long to keep, wait for the next head
+    loop_last_address = strtoul(buffer, NULL, 16);
+    iplc_sim_parse_instruction(buffer);
+}
+
+/*
+ * Skip over iterations that repeat the last one, starting with the head
+ * line in buffer.  Returns 1 with the line that broke the pattern left in
+ * buffer, still to be simulated, or 0 at the end of the trace.
+ */
+int iplc_sim_loop_extrapolate(char *buffer, FILE *trace_file)
+{
+    sim_counters_t now, delta;
+    long delta_fast_hits = fast_hits - loop_fast_hits;
+    long delta_block_bulk = block_bulk - loop_block_bulk;
+    char line[80];
+    int pos = 0, pending = 1, k;
+    
+    iplc_sim_get_counters(&now);
+    delta.cache_access = now.cache_access - loop_counters.cache_access;
+    delta.cache_miss = now.cache_miss - loop_counters.cache_miss;
+    delta.cache_hit = now.cache_hit - loop_counters.cache_hit;
+    delta.pipeline_cycles = now.pipeline_cycles - loop_counters.pipeline_cycles;
+    delta.instruction_count = now.instruction_count - loop_counters.instruction_count;
+    delta.branch_count = now.branch_count - loop_counters.branch_count;
+    delta.correct_branch_predictions = now.correct_branch_predictions - loop_counters.correct_branch_predictions;
+    
+    for (;;) {
+        if (strcmp(buffer, loop_body[pos]) != 0)
+            break;
+        if (++pos == loop_lines) {
+            cache_access += delta.cache_access;
+            cache_miss += delta.cache_miss;
+            cache_hit += delta.cache_hit;
+            pipeline_cycles += delta.pipeline_cycles;
+            instruction_count += delta.instruction_count;
+            branch_count += delta.branch_count;
+            correct_branch_predictions += delta.correct_branch_predictions;
+            fast_hits += delta_fast_hits;
+            block_bulk += delta_block_bulk;
+            loop_iterations++;
+            loop_skipped += loop_lines;
+            pos = 0;
+        }
+        if (iplc_sim_read_line(buffer, trace_file) == NULL) {
+            pending = 0;
+            break;
+        }
+        trace_line++;
+    }
+    
+    // still in the steady state, the lines of the broken iteration go through in detail
+    iplc_sim_loop_start(loop_head);
+    for (k = 0; k < pos; k++) {
+        strcpy(line, loop_body[k]);
+        iplc_sim_loop_simulate(line);
+    }
+    return pending;
+}
+
+void iplc_sim_loop_step(char *buffer, FILE *trace_file)
+{
+    unsigned int address;
+    
+    for (;;) {
+        address = strtoul(buffer, NULL, 16);
+        if (address == loop_head || address < loop_last_address) {
+            // a new iteration, of this loop or of one just jumped back to
+            iplc_sim_block_flush();
+            if (address == loop_head && loop_lines > 0 && iplc_sim_loop_steady()) {
+                if (iplc_sim_loop_extrapolate(buffer, trace_file))
+                    continue;
+                return;
+            }
+            iplc_sim_loop_start(address);
+        }
+        iplc_sim_loop_simulate(buffer);
+        return;
+    }
+}
+
+/************************************************************************************************/
+/* Trigger Functions ****************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Triggered tracing (-T) prints only windows around points of interest.
+ * Outside a window, each trace line only copies the pipeline into a ring
+ * of the last pre lines.  When a trigger fires, the ring is printed,
+ * followed by the next post lines with the access lines of -q switched
+ * back on.  Firing again inside a window extends it.
+ */
+
+/*
+ * Parse a list such as "pc=400264-400300,dmiss=3,pre=8,post=32".
+ */
+void iplc_sim_trigger_configure(char *spec)
+{
+    char *opt, *value;
+    int event;
+    
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        value = strchr(opt, '=');
+        if (value == NULL) {
+            printf("Unknown trigger option: %s \n", opt);
+            exit(-1);
+        }
+        value++;
+        for (event = 0; event < TRIGGER_EVENTS; event++)
+            if (strncmp(opt, trigger_event_name[event], value - opt - 1) == 0 &&
+                strlen(trigger_event_name[event]) == value - opt - 1)
+                break;
+        if (event < TRIGGER_EVENTS)
+            trigger_nth[event] = atol(value);
+        else if (strncmp(opt, "pc=", 3) == 0 &&
+                 sscanf(value, "%x-%x", &trigger_pc_lo, &trigger_pc_hi) == 2)
+            ;
+        else if (strncmp(opt, "cycle=", 6) == 0 &&
+                 sscanf(value, "%u-%u", &trigger_cycle_lo, &trigger_cycle_hi) == 2)
+            ;
+        else if (strncmp(opt, "miss=", 5) == 0 && sscanf(value, "%x", &trigger_miss_address) == 1)
+            trigger_miss_set = 1;
+        else if (strncmp(opt, "pre=", 4) == 0)
+            trigger_pre = atoi(value);
+        else if (strncmp(opt, "post=", 5) == 0)
+            trigger_post = atoi(value);
+        else {
+            printf("Unknown trigger option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    if (trigger_pre < 0 || trigger_post < 0) {
+        printf("Trigger windows cannot be negative \n");
+        exit(-1);
+    }
+    trigger_ring = (trigger_record_t *)malloc(sizeof(trigger_record_t) * (trigger_pre + 1));
+    trigger_mode = 1;
+}
+
+/*
+ * Count an event, firing on the occurrence asked for.
+ */
+void iplc_sim_trigger_event(int event, unsigned int address)
+{
+    if (++trigger_seen[event] == trigger_nth[event] && !trigger_pending) {
+        sprintf(trigger_reason, "%s %ld at 0x%x", trigger_event_name[event], trigger_seen[event], address);
+        trigger_pending = 1;
+    }
+}
+
+void iplc_sim_trigger_miss(unsigned int address)
+{
+    iplc_sim_trigger_event(access_is_data ? TRIGGER_DMISS : TRIGGER_IMISS, address);
+    if (trigger_miss_set && !trigger_pending &&
+        address >> cache_blockoffsetbits == trigger_miss_address >> cache_blockoffsetbits) {
+        sprintf(trigger_reason, "miss on 0x%x", address);
+        trigger_pending = 1;
+    }
+}
+
+/*
+ * After each trace line: check the range triggers, then either print the
+ * pipeline or keep it in the ring.
+ */
+void iplc_sim_trigger_line()
+{
+    trigger_record_t *record;
+    long k, first;
+    
+    if (!trigger_pending) {
+        if (instruction_address >= trigger_pc_lo && instruction_address <= trigger_pc_hi) {
+            sprintf(trigger_reason, "pc 0x%x", instruction_address);
+            trigger_pending = 1;
+        }
+        else if (pipeline_cycles >= trigger_cycle_lo && pipeline_cycles <= trigger_cycle_hi) {
+            sprintf(trigger_reason, "cycle %u", pipeline_cycles);
+            trigger_pending = 1;
+        }
+    }
+    
+    if (trigger_pending) {
+        if (trigger_remaining == 0) {
+            printf("TRIGGER: %s \n", trigger_reason);
+            first = trigger_recorded > trigger_pre ? trigger_recorded - trigger_pre : 0;
+            for (k = first; k < trigger_recorded; k++) {
+                record = &trigger_ring[k % (trigger_pre + 1)];
+                iplc_sim_dump_stages(record->cycle, record->stage);
+            }
+            trigger_windows++;
+        }
+        trigger_remaining = trigger_post + 1;
+        trigger_pending = 0;
+    }
+    
+    if (trigger_remaining > 0) {
+        iplc_sim_dump_pipeline();
+        trigger_recorded = 0;
+        trigger_remaining--;
+        trace_output = trigger_remaining > 0;
+    }
+    else {
+        record = &trigger_ring[trigger_recorded++ % (trigger_pre + 1)];
+        record->cycle = pipeline_cycles;
+        memcpy(record->stage, pipeline, sizeof(pipeline));
+    }
+}
+
+/************************************************************************************************/
+/* Timeline Functions ***************************************************************************/
+/************************************************************************************************/
+
+/*
+ * The timeline (-X) is a Chrome trace event file, which chrome://tracing
+ * and the Perfetto UI both open.  One microsecond stands for one cycle.
+ * Each stage is a thread holding a slice per instruction for as long as
+ * it sat there, so bubbles show up as gaps.  Stalls, misses and
+ * mispredicts go on a thread of their own.  Events are written as the
+ * pipeline moves and nothing is kept, so memory stays the same however
+ * long the run.
+ */
+char *timeline_stage_name[MAX_STAGES + 1] = {"FETCH", "DECODE", "ALU", "MEM", "WB", "Stalls"};
+char *timeline_itype_name[] = {"nop", "rtype", "lw", "sw", "branch", "jump", "jal", "syscall"};
+
+void iplc_sim_timeline_open(char *file_name)
+{
+    int i;
+    
+    timeline_file = fopen(file_name, "w");
+    if (timeline_file == NULL) {
+        printf("fopen failed for %s file\n", file_name);
+        exit(-1);
+    }
+    setvbuf(timeline_file, NULL, _IOFBF, 1 << 20);
+    
+    fprintf(timeline_file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"args\":{\"name\":\"iplc-sim, 1 us = 1 cycle\"}}");
+    for (i = 0; i <= MAX_STAGES; i++) {
+        fprintf(timeline_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", i, timeline_stage_name[i]);
+        fprintf(timeline_file, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"sort_index\":%d}}", i, i);
+    }
+}
+
+/*
+ * Called at the end of every push: each occupied stage held its
+ * instruction from the previous push until now.
+ */
+void iplc_sim_timeline_push()
+{
+    int i;
+    
+    for (i = 0; i < MAX_STAGES; i++) {
+        if (!pipeline[i].instruction_address)
+            continue;
+        fprintf(timeline_file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%u,\"dur\":%u,"
+                "\"args\":{\"pc\":\"0x%x\"}}",
+                pipeline[i].itype == RTYPE ? pipeline[i].stage.rtype.instruction
+                                           : timeline_itype_name[pipeline[i].itype],
+                i, timeline_last, pipeline_cycles - timeline_last, pipeline[i].instruction_address);
+    }
+    timeline_last = pipeline_cycles;
+}
+
+/*
+ * A stall of the given cause starting at start, at the instruction pc and
+ * for the access to address when there is one.
+ */
+void iplc_sim_timeline_stall(char *cause, unsigned int start, unsigned int cycles,
+                             unsigned int pc, unsigned int address)
+{
+    fprintf(timeline_file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%u,\"dur\":%u,"
+            "\"args\":{\"pc\":\"0x%x\"", cause, MAX_STAGES, start, cycles, pc);
+    if (address)
+        fprintf(timeline_file, ",\"address\":\"0x%x\"", address);
+    fprintf(timeline_file, "}}");
+}
+
+void iplc_sim_timeline_close()
+{
+    fprintf(timeline_file, "\n]\n");
+    fclose(timeline_file);
+    timeline_file = NULL;
+}
+
+/************************************************************************************************/
+/* Functional Front-End Functions ***************************************************************/
+/************************************************************************************************/
+
+/*
+ * The functional front-end (-F) runs a MIPS program instead of replaying
+ * a trace.  A program is a listing in the trace's own syntax, one
+ * "0xADDR  op operands" line per instruction, so a trace can be run as a
+ * program too: later lines at an address already seen are skipped, and
+ * the data address after a load or store is ignored.  Data is given as
+ * "0xADDR  .word v1, v2, ..." and everything else in memory reads as 0.
+ * Lines starting with # are comments.
+ *
+ * Each static instruction is decoded once, through the trace decoder, into
+ * the record iplc_sim_execute_instruction() takes.  Running the program
+ * only fills in data addresses and follows branches.  Branch offsets are in
+ * bytes from the branch, as in the traces, and jal links to the next
+ * instruction, since there are no delay slots.  A syscall with $2 == 10
+ * ends the run.
+ */
+
+char *func_reg_name[32] = {"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+                           "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+                           "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+                           "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"};
+
+/*
+ * Parse "-F program=file,sp=0x7fffeffc,entry=0x400000,max=N,dump=file".
+ */
+void iplc_sim_func_configure(char *spec)
+{
+    char *opt;
+    
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (strncmp(opt, "program=", 8) == 0)
+            func_program = opt + 8;
+        else if (strncmp(opt, "sp=", 3) == 0)
+            func_sp = strtoul(opt + 3, NULL, 0);
+        else if (strncmp(opt, "entry=", 6) == 0)
+            func_entry = strtoul(opt + 6, NULL, 0);
+        else if (strncmp(opt, "max=", 4) == 0)
+            func_max = atol(opt + 4);
+        else if (strncmp(opt, "dump=", 5) == 0)
+            func_dump_name = opt + 5;
+        else if (strchr(opt, '=') == NULL && func_program == NULL)
+            func_program = opt;
+        else {
+            printf("Unknown front-end option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    if (func_program == NULL) {
+        printf("The front-end needs a program \n");
+        exit(-1);
+    }
+    func_mode = 1;
+}
+
+/*
+ * Register number of "$13," or "$sp", -1 when it is neither.
+ */
+int iplc_sim_func_reg(char *str)
+{
+    char name[16];
+    int i;
+    
+    if (sscanf(str, " $%15[0-9a-z]", name) != 1)
+        return -1;
+    if (name[0] >= '0' && name[0] <= '9')
+        return atoi(name) & 31;
+    for (i = 0; i < 32; i++)
+        if (strcmp(name, func_reg_name[i]) == 0)
+            return i;
+    return -1;
+}
+
+/*
+ * Decode one instruction line into f.  Returns 0 if the operands do not
+ * fit the instruction.
+ */
+int iplc_sim_func_assemble(unsigned int address, char *op, char *operands, func_instruction_t *f)
+{
+    char arg[3][32], *colon, line[96];
+    int n;
+    
+    // a load or store copied from a trace still carries its data address
+    if ((colon = strchr(operands, ':')) != NULL)
+        *colon = '\0';
+    n = sscanf(operands, " %31[^,] , %31[^,] , %31s", arg[0], arg[1], arg[2]);
+    
+    bzero(f, sizeof(func_instruction_t));
+    if (strcmp(op, "add") == 0 || strcmp(op, "addu") == 0) {
+        f->op = FUNC_ADD;
+        f->rd = iplc_sim_func_reg(arg[0]);
+        f->rs = iplc_sim_func_reg(arg[1]);
+        f->rt = iplc_sim_func_reg(arg[2]);
+        if (n != 3 || f->rd < 0 || f->rs < 0 || f->rt < 0)
+            return 0;
+    }
+    else if (strcmp(op, "addi") == 0 || strcmp(op, "addiu") == 0 || strcmp(op, "ori") == 0 ||
+             strcmp(op, "sll") == 0) {
+        f->op = op[0] == 'o' ? FUNC_ORI : op[0] == 's' ? FUNC_SLL : FUNC_ADDI;
+        f->rt = iplc_sim_func_reg(arg[0]);
+        f->rs = iplc_sim_func_reg(arg[1]);
+        f->imm = strtol(arg[2], NULL, 0);
+        if (n != 3 || f->rt < 0 || f->rs < 0)
+            return 0;
+    }
+    else if (strcmp(op, "lui") == 0) {
+        f->op = FUNC_LUI;
+        f->rt = iplc_sim_func_reg(arg[0]);
+        f->imm = strtol(arg[1], NULL, 0);
+        if (n != 2 || f->rt < 0)
+            return 0;
+    }
+    else if (strcmp(op, "lw") == 0 || strcmp(op, "sw") == 0) {
+        f->op = op[0] == 'l' ? FUNC_LW : FUNC_SW;
+        f->rt = iplc_sim_func_reg(arg[0]);
+        f->imm = strtol(arg[1], &colon, 0);
+        f->rs = *colon == '(' ? iplc_sim_func_reg(colon + 1) : -1;
+        if (n != 2 || f->rt < 0 || f->rs < 0)
+            return 0;
+    }
+    else if (strcmp(op, "beq") == 0) {
+        f->op = FUNC_BEQ;
+        f->rs = iplc_sim_func_reg(arg[0]);
+        f->rt = iplc_sim_func_reg(arg[1]);
+        f->imm = strtol(arg[2], NULL, 0);
+        if (n != 3 || f->rs < 0 || f->rt < 0)
+            return 0;
+    }
+    else if (strcmp(op, "j") == 0 || strcmp(op, "jal") == 0) {
+        f->op = op[1] ? FUNC_JAL : FUNC_J;
+        f->imm = strtoul(arg[0], NULL, 0);
+        if (n != 1)
+            return 0;
+    }
+    else if (strcmp(op, "jr") == 0) {
+        f->op = FUNC_JR;
+        f->rs = iplc_sim_func_reg(arg[0]);
+        if (n != 1 || f->rs < 0)
+            return 0;
+    }
+    else if (strcmp(op, "syscall") == 0)
+        f->op = FUNC_SYSCALL;
+    else if (strcmp(op, "nop") == 0)
+        f->op = FUNC_NOP;
+    else
+        return 0;
+    
+    // render the line as a trace would show it, so the pipeline sees exactly
+    // what the trace decoder makes of it
+    switch (f->op) {
+        case FUNC_ADD:
+            snprintf(f->text, sizeof(f->text), "%s $%d, $%d, $%d", op, f->rd, f->rs, f->rt);
+            break;
+        case FUNC_ADDI:
+        case FUNC_ORI:
+        case FUNC_SLL:
+            snprintf(f->text, sizeof(f->text), "%s $%d, $%d, %d", op, f->rt, f->rs, f->imm);
+            break;
+        case FUNC_LUI:
+            snprintf(f->text, sizeof(f->text), "%s $%d, %d", op, f->rt, f->imm);
+            break;
+        case FUNC_LW:
+        case FUNC_SW:
+            snprintf(f->text, sizeof(f->text), "%s $%d, %d($%d)", op, f->rt, f->imm, f->rs);
+            break;
+        case FUNC_BEQ:
+            snprintf(f->text, sizeof(f->text), "%s $%d, $%d, %d", op, f->rs, f->rt, f->imm);
+            break;
+        case FUNC_J:
+        case FUNC_JAL:
+            snprintf(f->text, sizeof(f->text), "%s 0x%08x", op, f->imm);
+            break;
+        case FUNC_JR:
+            snprintf(f->text, sizeof(f->text), "%s $%d", op, f->rs);
+            break;
+        default:
+            snprintf(f->text, sizeof(f->text), "%s", op);
+            break;
+    }
+    snprintf(line, sizeof(line), "0x%08x  %s%s\n", address, f->text,
+             f->op == FUNC_LW || f->op == FUNC_SW ? ": 00000000" : "");
+    iplc_sim_decode_instruction(line, &f->decoded);
+    return 1;
+}
+
+void iplc_sim_func_load()
+{
+    FILE *fp = fopen(func_program, "r");
+    char buffer[256], op[16], operands[128], *value;
+    func_instruction_t *code = NULL, f;
+    unsigned int address, *at = NULL, lo = 0xffffffff, hi = 0;
+    int count = 0, size = 0, line = 0, i;
+    
+    if (fp == NULL) {
+        printf("fopen failed for %s file\n", func_program);
+        exit(-1);
+    }
+    block_map_init(&func_memory, 1024);
+    
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        line++;
+        operands[0] = '\0';
+        if (buffer[0] == '#' || sscanf(buffer, "%x %15s %127[^\n]", &address, op, operands) < 2)
+            continue;
+        
+        if (strcmp(op, ".word") == 0) {
+            for (value = strtok(operands, ", "); value != NULL; value = strtok(NULL, ", "), address += 4)
+                block_map_put(&func_memory, address >> 2, strtoul(value, NULL, 0) & 0xffffffffUL);
+            continue;
+        }
+        if (address & 3 || !iplc_sim_func_assemble(address, op, operands, &f)) {
+            printf("Cannot run %s at address 0x%x, line %d of %s \n", op, address, line, func_program);
+            exit(-1);
+        }
+        
+        if (count == size) {
+            size = size ? size * 2 : 1024;
+            code = (func_instruction_t *)realloc(code, sizeof(func_instruction_t) * size);
+            at = (unsigned int *)realloc(at, sizeof(unsigned int) * size);
+        }
+        code[count] = f;
+        at[count++] = address;
+        if (count == 1 && func_entry == 0)
+            func_entry = address;
+        if (address < lo)
+            lo = address;
+        if (address > hi)
+            hi = address;
+    }
+    fclose(fp);
+    
+    if (count == 0) {
+        printf("No instructions in %s \n", func_program);
+        exit(-1);
+    }
+    
+    // the text segment is dense enough to index by address
+    func_text_base = lo;
+    func_text_words = (hi - lo) / 4 + 1;
+    func_text = (func_instruction_t **)calloc(func_text_words, sizeof(func_instruction_t *));
+    func_code = code;
+    for (i = 0, line = 0; i < count; i++)
+        if (func_text[(at[i] - lo) / 4] == NULL) {  // a trace repeats what it already showed
+            func_text[(at[i] - lo) / 4] = &code[i];
+            line++;
+        }
+    free(at);
+    
+    printf("Loaded %d instructions of %s, entry 0x%x \n", line, func_program, func_entry);
+}
+
+/*
+ * Execute the program until it exits, pushing every instruction through
+ * the pipeline as it goes.
+ */
+void iplc_sim_func_run()
+{
+    func_instruction_t *f;
+    decoded_instruction_t decoded;
+    unsigned int reg[32], pc, next, word;
+    long value;
+    FILE *dump = NULL;
+    
+    if (func_dump_name && (dump = fopen(func_dump_name, "w")) == NULL) {
+        printf("fopen failed for %s file\n", func_dump_name);
+        exit(-1);
+    }
+    bzero(reg, sizeof(reg));
+    reg[28] = 0x10008000;         // $gp
+    reg[29] = func_sp;
+    pc = func_entry;
+    
+    while (func_max == 0 || func_executed < func_max) {
+        word = (pc - func_text_base) / 4;
+        if (pc & 3 || pc < func_text_base || word >= func_text_words || (f = func_text[word]) == NULL) {
+            printf("Fetch from 0x%x outside the program after %ld instructions \n", pc, func_executed);
+            exit(-1);
+        }
+        decoded = f->decoded;
+        next = pc + 4;
+        
+        switch (f->op) {
+            case FUNC_ADD:
+                reg[f->rd] = reg[f->rs] + reg[f->rt];
+                break;
+            case FUNC_ADDI:
+                reg[f->rt] = reg[f->rs] + f->imm;
+                break;
+            case FUNC_ORI:
+                reg[f->rt] = reg[f->rs] | (f->imm & 0xffff);
+                break;
+            case FUNC_SLL:
+                reg[f->rt] = reg[f->rs] << (f->imm & 31);
+                break;
+            case FUNC_LUI:
+                reg[f->rt] = f->imm << 16;
+                break;
+            case FUNC_LW:
+                decoded.data_address = reg[f->rs] + f->imm;
+                value = block_map_get(&func_memory, decoded.data_address >> 2);
+                reg[f->rt] = value < 0 ? 0 : (unsigned int) value;
+                break;
+            case FUNC_SW:
+                decoded.data_address = reg[f->rs] + f->imm;
+                block_map_put(&func_memory, decoded.data_address >> 2, reg[f->rt]);
+                break;
+            case FUNC_BEQ:
+                if (reg[f->rs] == reg[f->rt])
+                    next = pc + f->imm;
+                break;
+            case FUNC_JAL:
+                reg[31] = pc + 4;
+                next = f->imm;
+                break;
+            case FUNC_J:
+                next = f->imm;
+                break;
+            case FUNC_JR:
+                next = reg[f->rs];
+                break;
+            case FUNC_SYSCALL:
+            case FUNC_NOP:
+                break;
+        }
+        reg[0] = 0;
+        
+        if (dump) {
+            if (f->op == FUNC_LW || f->op == FUNC_SW)
+                fprintf(dump, "0x%08x  %s: %08x\n", pc, f->text, decoded.data_address);
+            else
+                fprintf(dump, "0x%08x  %s\n", pc, f->text);
+        }
+        
+        iplc_sim_execute_instruction(&decoded);
+        func_executed++;
+        if (trigger_mode)
+            iplc_sim_trigger_line();
+        if (dump_pipeline)
+            iplc_sim_dump_pipeline();
+        trace_line++;
+        
+        if (f->op == FUNC_SYSCALL && reg[2] == 10)
+            break;
+        pc = next;
+    }
+    
+    if (dump)
+        fclose(dump);
+    printf("Executed %ld instructions \n", func_executed);
+}
+
+/************************************************************************************************/
+/* Compressed Trace Functions *******************************************************************/
+/************************************************************************************************/
+
+/*
+ * A compressed trace (-Z) holds the same lines as a text trace in about a
+ * twentieth of the space.  Each distinct instruction text at each address
+ * goes once into a dictionary, and a line is stored as:
+ *
+ *   - one varint, 0 when the line is the first dictionary entry at the previous
+ *     line's address + 4, otherwise its entry number + 1;
+ *   - for a load or store, a zigzag varint of how far the data address is
+ *     off the previous address plus stride of the same entry.
+ *
+ * So straight-line code costs one byte a line and a strided load or store
+ * two.  Lines are cut into blocks of ZTRACE_BLOCK_LINES that each start
+ * with no history, so the index of block offsets at the end of the file
+ * can start decoding at any line.  Every dictionary entry is decoded once,
+ * through the text decoder, when the trace is opened; after that a line
+ * costs a table copy instead of an fgets() and sscanf().
+ *
+ * The layout is a header, the blocks, the dictionary, then the index.
+ * Numbers are stored as they are in memory, like checkpoints, so a
+ * compressed trace is read on the kind of machine that wrote it.
+ */
+
+void iplc_sim_ztrace_io(FILE *fp, void *ptr, size_t size, int save)
+{
+    size_t done;
+    
+    if (size == 0)
+        return;
+    
+    done = save ? fwrite(ptr, size, 1, fp) : fread(ptr, size, 1, fp);
+    if (done != 1) {
+        printf("Compressed trace %s failed \n", save ? "write" : "read");
+        exit(-1);
+    }
+}
+
+unsigned char *iplc_sim_ztrace_put(unsigned char *p, unsigned int value)
+{
+    while (value >= 0x80) {
+        *p++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+static inline unsigned int iplc_sim_ztrace_get()
+{
+    unsigned int value = 0;
+    int shift = 0;
+    
+    while (*ztrace_cursor & 0x80) {
+        value |= (*ztrace_cursor++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | *ztrace_cursor++ << shift;
+}
+
+/*
+ * Entry at the address after each entry's, the lowest numbered one if
+ * there are several, or -1.
+ */
+void iplc_sim_ztrace_link(block_map_t *first)
+{
+    long id;
+    
+    ztrace_next = (int *)malloc(sizeof(int) * ztrace_header.entries);
+    for (id = 0; id < ztrace_header.entries; id++)
+        ztrace_next[id] = block_map_get(first, (ztrace_pc[id] + 4) >> 2);
+}
+
+/*
+ * Split one trace line into the entry's text and the data address, if any.
+ */
+int iplc_sim_ztrace_split(char *buffer, unsigned int *pc, char *text, unsigned int *address)
+{
+    char *colon;
+    int start = 0, length;
+    
+    if (sscanf(buffer, "%x %n", pc, &start) < 1 || start == 0)
+        return -1;
+    
+    *address = 0;
+    length = strlen(buffer + start);
+    if ((colon = strchr(buffer + start, ':')) != NULL) {
+        length = colon - (buffer + start);
+        *address = strtoul(colon + 1, NULL, 16);
+    }
+    while (length > 0 && (buffer[start+length-1] == ' ' || buffer[start+length-1] == '\n' ||
+                          buffer[start+length-1] == '\r'))
+        length--;
+    memcpy(text, buffer + start, length);
+    text[length] = '\0';
+    return colon != NULL;
+}
+
+/*
+ * Compress a text trace into file_name.  The first pass builds the
+ * dictionary, the second writes the lines a block at a time.
+ */
+void iplc_sim_ztrace_write(FILE *trace_file, char *file_name)
+{
+    FILE *fp = fopen(file_name, "wb");
+    char buffer[80], text[80], (*entry_text)[80] = NULL;
+    unsigned char *block, *p, length;
+    unsigned int pc, address, delta, *last, *stride;
+    long id, line = 0, size = 0, *same = NULL, *stamp, bytes = 0, end;
+    int data, prev = -1;
+    block_map_t first;            // address -> lowest numbered entry there
+    ztrace_block_t *index;
+    
+    if (fp == NULL) {
+        printf("fopen failed for %s file\n", file_name);
+        exit(-1);
+    }
+    bzero(&ztrace_header, sizeof(ztrace_header));
+    memcpy(ztrace_header.magic, ZTRACE_MAGIC, 8);
+    ztrace_header.block_lines = ZTRACE_BLOCK_LINES;
+    block_map_init(&first, 1024);
+    
+    rewind(trace_file);
+    while (fgets(buffer, 80, trace_file) != NULL) {
+        if ((data = iplc_sim_ztrace_split(buffer, &pc, text, &address)) < 0) {
+            printf("Malformed instruction at line %ld \n", ztrace_header.lines + 1);
+            exit(-1);
+        }
+        ztrace_header.lines++;
+        
+        for (id = block_map_get(&first, pc >> 2); id >= 0; id = same[id])
+            if (ztrace_pc[id] == pc && strcmp(entry_text[id], text) == 0)
+                break;
+        if (id >= 0)
+            continue;
+        
+        if (ztrace_header.entries == size) {
+            size = size ? size * 2 : 1024;
+            ztrace_pc = (unsigned int *)realloc(ztrace_pc, sizeof(unsigned int) * size);
+            ztrace_has_data = (unsigned char *)realloc(ztrace_has_data, size);
+            entry_text = realloc(entry_text, sizeof(*entry_text) * size);
+            same = (long *)realloc(same, sizeof(long) * size);
+        }
+        id = ztrace_header.entries++;
+        ztrace_pc[id] = pc;
+        ztrace_has_data[id] = data;
+        strcpy(entry_text[id], text);
+        same[id] = -1;
+        if (block_map_get(&first, pc >> 2) < 0)
+            block_map_put(&first, pc >> 2, id);
+        else {
+            long tail = block_map_get(&first, pc >> 2);
+            
+            while (same[tail] >= 0)
+                tail = same[tail];
+            same[tail] = id;
+        }
+    }
+    iplc_sim_ztrace_link(&first);
+    
+    ztrace_header.blocks = (ztrace_header.lines + ZTRACE_BLOCK_LINES - 1) / ZTRACE_BLOCK_LINES;
+    index = (ztrace_block_t *)malloc(sizeof(ztrace_block_t) * (ztrace_header.blocks + 1));
+    block = (unsigned char *)malloc(10 * ZTRACE_BLOCK_LINES);
+    last = (unsigned int *)calloc(ztrace_header.entries, sizeof(unsigned int));
+    stride = (unsigned int *)calloc(ztrace_header.entries, sizeof(unsigned int));
+    stamp = (long *)malloc(sizeof(long) * ztrace_header.entries);
+    for (id = 0; id < ztrace_header.entries; id++)
+        stamp[id] = -1;
+    iplc_sim_ztrace_io(fp, &ztrace_header, sizeof(ztrace_header), 1);
+    
+    rewind(trace_file);
+    p = block;
+    while (fgets(buffer, 80, trace_file) != NULL) {
+        data = iplc_sim_ztrace_split(buffer, &pc, text, &address);
+        for (id = block_map_get(&first, pc >> 2); ztrace_pc[id] != pc || strcmp(entry_text[id], text); )
+            id = same[id];
+        
+        // each block starts with no history
+        if (line % ZTRACE_BLOCK_LINES == 0)
+            prev = -1;
+        p = iplc_sim_ztrace_put(p, prev >= 0 && ztrace_next[prev] == id ? 0 : id + 1);
+        if (data) {
+            if (stamp[id] != line / ZTRACE_BLOCK_LINES) {
+                stamp[id] = line / ZTRACE_BLOCK_LINES;
+                last[id] = stride[id] = 0;
+            }
+            delta = address - last[id] - stride[id];
+            p = iplc_sim_ztrace_put(p, (delta << 1) ^ -(delta >> 31));
+            stride[id] = address - last[id];
+            last[id] = address;
+        }
+        prev = id;
+        
+        if (++line % ZTRACE_BLOCK_LINES == 0 || line == ztrace_header.lines) {
+            index[(line - 1) / ZTRACE_BLOCK_LINES].offset = ftell(fp);
+            index[(line - 1) / ZTRACE_BLOCK_LINES].bytes = p - block;
+            iplc_sim_ztrace_io(fp, block, p - block, 1);
+            bytes += p - block;
+            p = block;
+        }
+    }
+    
+    ztrace_header.dictionary_offset = ftell(fp);
+    for (id = 0; id < ztrace_header.entries; id++) {
+        length = strlen(entry_text[id]);
+        iplc_sim_ztrace_io(fp, &ztrace_pc[id], sizeof(unsigned int), 1);
+        iplc_sim_ztrace_io(fp, &ztrace_has_data[id], 1, 1);
+        iplc_sim_ztrace_io(fp, &length, 1, 1);
+        iplc_sim_ztrace_io(fp, entry_text[id], length, 1);
+    }
+    ztrace_header.index_offset = ftell(fp);
+    iplc_sim_ztrace_io(fp, index, sizeof(ztrace_block_t) * ztrace_header.blocks, 1);
+    end = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    iplc_sim_ztrace_io(fp, &ztrace_header, sizeof(ztrace_header), 1);
+    
+    printf("Compressed %ld lines into %s \n", ztrace_header.lines, file_name);
+    printf("\t Dictionary Entries is %ld \n", ztrace_header.entries);
+    printf("\t Blocks is %ld of %d lines \n", ztrace_header.blocks, ZTRACE_BLOCK_LINES);
+    printf("\t Bytes per Line is %f \n", ztrace_header.lines ? (double)bytes / ztrace_header.lines : 0.0);
+    printf("\t Compression Ratio is %f \n", (double)ftell(trace_file) / end);
+    
+    fclose(fp);
+    free(block);
+    free(index);
+    free(entry_text);
+    free(same);
+    free(last);
+    free(stride);
+    free(stamp);
+    free(first.key);
+    free(first.val);
+}
+
+/*
+ * Open file_name as a compressed trace.  Returns 0, with nothing changed,
+ * if it is a text trace.
+ */
+int iplc_sim_ztrace_open(char *file_name)
+{
+    FILE *fp = fopen(file_name, "rb");
+    char line[128], text[80];
+    unsigned char length;
+    long id, max_bytes = 0;
+    block_map_t first;
+    
+    if (fp == NULL)
+        return 0;
+    if (fread(&ztrace_header, sizeof(ztrace_header), 1, fp) != 1 ||
+        memcmp(ztrace_header.magic, ZTRACE_MAGIC, 8) != 0) {
+        fclose(fp);
+        return 0;
+    }
+    
+    ztrace_pc = (unsigned int *)malloc(sizeof(unsigned int) * ztrace_header.entries);
+    ztrace_has_data = (unsigned char *)malloc(ztrace_header.entries);
+    ztrace_template = (decoded_instruction_t *)malloc(sizeof(decoded_instruction_t) * ztrace_header.entries);
+    ztrace_last = (unsigned int *)malloc(sizeof(unsigned int) * ztrace_header.entries);
+    ztrace_stride = (unsigned int *)malloc(sizeof(unsigned int) * ztrace_header.entries);
+    ztrace_stamp = (long *)malloc(sizeof(long) * ztrace_header.entries);
+    block_map_init(&first, 1024);
+    
+    fseek(fp, ztrace_header.dictionary_offset, SEEK_SET);
+    for (id = 0; id < ztrace_header.entries; id++) {
+        iplc_sim_ztrace_io(fp, &ztrace_pc[id], sizeof(unsigned int), 0);
+        iplc_sim_ztrace_io(fp, &ztrace_has_data[id], 1, 0);
+        iplc_sim_ztrace_io(fp, &length, 1, 0);
+        if (length >= sizeof(text)) {
+            printf("Compressed trace %s is corrupt \n", file_name);
+            exit(-1);
+        }
+        iplc_sim_ztrace_io(fp, text, length, 0);
+        text[length] = '\0';
+        
+        // the same line a text trace would have, decoded the same way
+        snprintf(line, sizeof(line), "0x%08x  %s%s\n", ztrace_pc[id], text,
+                 ztrace_has_data[id] ? ": 00000000" : "");
+        iplc_sim_decode_instruction(line, &ztrace_template[id]);
+        ztrace_stamp[id] = -1;
+        if (block_map_get(&first, ztrace_pc[id] >> 2) < 0)
+            block_map_put(&first, ztrace_pc[id] >> 2, id);
+    }
+    iplc_sim_ztrace_link(&first);
+    free(first.key);
+    free(first.val);
+    
+    ztrace_index = (ztrace_block_t *)malloc(sizeof(ztrace_block_t) * ztrace_header.blocks);
+    fseek(fp, ztrace_header.index_offset, SEEK_SET);
+    iplc_sim_ztrace_io(fp, ztrace_index, sizeof(ztrace_block_t) * ztrace_header.blocks, 0);
+    for (id = 0; id < ztrace_header.blocks; id++)
+        if (ztrace_index[id].bytes > max_bytes)
+            max_bytes = ztrace_index[id].bytes;
+    ztrace_buffer = (unsigned char *)malloc(max_bytes + 1);
+    
+    ztrace_file = fp;
+    ztrace_mode = 1;
+    iplc_sim_ztrace_seek(0);
+    return 1;
+}
+
+/*
+ * Position the compressed trace so the next line read is the given one:
+ * load its block through the index and decode up to it.
+ */
+void iplc_sim_ztrace_seek(long line)
+{
+    decoded_instruction_t decoded;
+    long skip;
+    
+    ztrace_block = line / ztrace_header.block_lines;
+    ztrace_cursor = ztrace_end = ztrace_buffer;
+    if (ztrace_block >= ztrace_header.blocks)
+        return;
+    
+    if (fseek(ztrace_file, ztrace_index[ztrace_block].offset, SEEK_SET) != 0) {
+        printf("Compressed trace read failed \n");
+        exit(-1);
+    }
+    iplc_sim_ztrace_io(ztrace_file, ztrace_buffer, ztrace_index[ztrace_block].bytes, 0);
+    ztrace_end = ztrace_buffer + ztrace_index[ztrace_block].bytes;
+    ztrace_prev = -1;
+    ztrace_loads++;               // even a reload of the same block forgets its deltas
+    
+    for (skip = line % ztrace_header.block_lines; skip > 0; skip--)
+        iplc_sim_ztrace_next(&decoded);
+}
+
+/*
+ * Decode the next line of the compressed trace.  Returns 0 at the end.
+ */
+int iplc_sim_ztrace_next(decoded_instruction_t *decoded)
+{
+    unsigned int code, delta, address;
+    int id;
+    
+    if (ztrace_cursor == ztrace_end) {
+        if (ztrace_block + 1 >= ztrace_header.blocks)
+            return 0;
+        iplc_sim_ztrace_seek((ztrace_block + 1) * ztrace_header.block_lines);
+    }
+    
+    code = iplc_sim_ztrace_get();
+    id = code ? code - 1 : ztrace_next[ztrace_prev];
+    *decoded = ztrace_template[id];
+    
+    if (ztrace_has_data[id]) {
+        if (ztrace_stamp[id] != ztrace_loads) {
+            ztrace_stamp[id] = ztrace_loads;
+            ztrace_last[id] = ztrace_stride[id] = 0;
+        }
+        delta = iplc_sim_ztrace_get();
+        address = ztrace_last[id] + ztrace_stride[id] + ((delta >> 1) ^ -(delta & 1));
+        ztrace_stride[id] = address - ztrace_last[id];
+        ztrace_last[id] = address;
+        decoded->data_address = address;
+    }
+    ztrace_prev = id;
+    return 1;
+}
+
+/*
+ * The plain run over a compressed trace.
+ */
+void iplc_sim_ztrace_run()
+{
+    decoded_instruction_t decoded;
+    
+    for (;;) {
+        if (profile_enabled)
+            iplc_sim_profile_enter(PROFILE_READ);
+        if (!iplc_sim_ztrace_next(&decoded))
+            break;
+        if (profile_enabled) {
+            iplc_sim_profile_exit();
+            iplc_sim_profile_enter(PROFILE_PARSE);
+        }
+        iplc_sim_execute_instruction(&decoded);
+        if (profile_enabled)
+            iplc_sim_profile_exit();
+        
+        if (trigger_mode)
+            iplc_sim_trigger_line();
+        if (dump_pipeline) {
+            if (profile_enabled)
+                iplc_sim_profile_enter(PROFILE_DUMP);
+            iplc_sim_dump_pipeline();
+            if (profile_enabled)
+                iplc_sim_profile_exit();
+        }
+        trace_line++;
+    }
+    if (profile_enabled)
+        iplc_sim_profile_exit();
+}
+
+/************************************************************************************************/
+/* Sampling Functions ***************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Parse a comma separated list such as "unit=1000,warm=2000,error=0.03".
+ */
+void iplc_sim_sample_configure(char *spec)
+{
+    char *opt, key[32], value[32];
+    
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (sscanf(opt, "%31[^=]=%31s", key, value) != 2) {
+            printf("Unknown sampling option: %s \n", opt);
+            exit(-1);
+        }
+        
+        if (strcmp(key, "unit") == 0)
+            sample_unit = atol(value);
+        else if (strcmp(key, "warm") == 0)
+            sample_warm = atol(value);
+        else if (strcmp(key, "samples") == 0)
+            sample_count = atol(value);
+        else if (strcmp(key, "error") == 0)
+            sample_error = atof(value);
+        else if (strcmp(key, "conf") == 0) {
+            if (strcmp(value, "90") == 0)
+                sample_z = 1.645;
+            else if (strcmp(value, "95") == 0)
+                sample_z = 1.960;
+            else if (strcmp(value, "99") == 0)
+                sample_z = 2.576;
+            else if (strcmp(value, "99.7") == 0)
+                sample_z = 3.0;
+            else {
+                printf("Confidence must be 90, 95, 99 or 99.7 \n");
+                exit(-1);
+            }
+        }
+        else {
+            printf("Unknown sampling option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    
+    if (sample_unit < 1 || sample_warm < 0 || sample_count < 2 || sample_error <= 0) {
+        printf("Bad sampling configuration \n");
+        exit(-1);
+    }
+    sample_mode = 1;
+}
+
+/*
+ * Functional warming: the line only touches the cache, the pipeline does not
+ * move and nothing is printed.
+ */
+void iplc_sim_warm_instruction(char *buffer)
+{
+    unsigned int address, data;
+    char op[16], *colon;
+    
+    if (sscanf(buffer, "%x %15s", &address, op) != 2)
+        return;
+    
+    iplc_sim_trap_address(address);
+    
+    if ((strcmp(op, "lw") == 0 || strcmp(op, "sw") == 0) &&
+        (colon = strchr(buffer, ':')) != NULL &&
+        sscanf(colon + 1, "%x", &data) == 1) {
+        access_is_data = 1;
+        iplc_sim_trap_address(data);
+        access_is_data = 0;
+    }
+}
+
+/*
+ * Mean and confidence half-width of n samples.
+ */
+void iplc_sim_sample_stats(double *x, long n, double *mean, double *half)
+{
+    double sum = 0, var = 0;
+    long i;
+    
+    for (i = 0; i < n; i++)
+        sum += x[i];
+    *mean = sum / n;
+    for (i = 0; i < n; i++)
+        var += (x[i] - *mean) * (x[i] - *mean);
+    var /= (n - 1);
+    *half = sample_z * sqrt(var / n);
+}
+
+/*
+ * SMARTS style systematic sampling.  The trace is cut into sample_count
+ * periods; the last sample_warm + sample_unit lines of each period run in
+ * full detail and only the final sample_unit lines are measured.  The rest
+ * is functionally warmed.  If the CPI estimate misses the error target the
+ * run is repeated with the number of samples the measured variance calls
+ * for.
+ */
+void iplc_sim_sample_run(FILE *trace_file)
+{
+    char buffer[80];
+    long lines = 0, line, period, pos, n, passes = 0, max_samples;
+    long cycles0 = 0, insts0 = 0, access0 = 0, miss0 = 0;
+    double *cpi = NULL, *rate = NULL, cpi_mean = 0, cpi_half = 0, rate_mean = 0, rate_half = 0;
+    
+    trace_output = 0;
+    dump_pipeline = 0;
+    
+    while (fgets(buffer, 80, trace_file) != NULL)
+        lines++;
+    
+    max_samples = lines / (sample_warm + sample_unit);
+    if (max_samples < 2) {
+        printf("Trace too short for sampling with unit %ld and warm %ld \n", sample_unit, sample_warm);
+        exit(-1);
+    }
+    if (sample_count > max_samples)
+        sample_count = max_samples;
+    
+    for (;;) {
+        passes++;
+        period = lines / sample_count;
+        cpi = (double *)realloc(cpi, sizeof(double) * sample_count);
+        rate = (double *)realloc(rate, sizeof(double) * sample_count);
+        n = 0;
+        
+        iplc_sim_reset();
+        rewind(trace_file);
+        
+        for (line = 0; fgets(buffer, 80, trace_file) != NULL; line++) {
+            pos = line % period;
+            
+            if (line >= period * sample_count || pos < period - sample_warm - sample_unit) {
+                warming = 1;
+                iplc_sim_warm_instruction(buffer);
+                warming = 0;
+                continue;
+            }
+            
+            if (pos == period - sample_unit) {
+                cycles0 = pipeline_cycles;
+                insts0 = instruction_count;
+                access0 = cache_access;
+                miss0 = cache_miss;
+            }
+            
+            iplc_sim_parse_instruction(buffer);
+            
+            if (pos == period - 1 && instruction_count > insts0) {
+                cpi[n] = (double)(pipeline_cycles - cycles0) / (double)(instruction_count - insts0);
+                rate[n] = (double)(cache_miss - miss0) / (double)(cache_access - access0);
+                n++;
+            }
+        }
+        
+        iplc_sim_sample_stats(cpi, n, &cpi_mean, &cpi_half);
+        iplc_sim_sample_stats(rate, n, &rate_mean, &rate_half);
+        
+        // n = (z * V / e)^2 from the measured coefficient of variation
+        if (cpi_half <= sample_error * cpi_mean || n == max_samples)
+            break;
+        sample_count = (long) ceil(pow(cpi_half * sqrt(n) / (sample_error * cpi_mean), 2));
+        if (sample_count <= n)
+            sample_count = n + 1;
+        if (sample_count > max_samples)
+            sample_count = max_samples;
+    }
+    
+    printf(" Sampled Performance \n");
+    printf("\t Trace Lines is %ld \n", lines);
+    printf("\t Samples is %ld (%ld measured + %ld warm lines each) \n", n, sample_unit, sample_warm);
+    printf("\t Detailed Fraction is %f \n", (double)n * (sample_unit + sample_warm) / lines);
+    printf("\t Passes is %ld \n", passes);
+    printf("\t Cache Miss Rate is %f +- %f \n", rate_mean, rate_half);
+    printf("\t CPI is %f +- %f \n", cpi_mean, cpi_half);
+    printf("\t CPI Relative Error is %f (target %f, z = %.3f) \n\n",
+           cpi_half / cpi_mean, sample_error, sample_z);
+    
+    free(cpi);
+    free(rate);
+}
+
+/************************************************************************************************/
+/* Phase Functions ******************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Parse a comma separated list such as "interval=1000,maxk=8,warm=2000".
+ */
+void iplc_sim_phase_configure(char *spec)
+{
+    char *opt, key[32], value[32];
+    
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (sscanf(opt, "%31[^=]=%31s", key, value) != 2) {
+            printf("Unknown phase option: %s \n", opt);
+            exit(-1);
+        }
+        
+        if (strcmp(key, "interval") == 0)
+            phase_interval = atol(value);
+        else if (strcmp(key, "maxk") == 0)
+            phase_maxk = atoi(value);
+        else if (strcmp(key, "warm") == 0)
+            phase_warm = atol(value);
+        else {
+            printf("Unknown phase option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    
+    if (phase_interval < 1 || phase_maxk < 1 || phase_warm < 0) {
+        printf("Bad phase configuration \n");
+        exit(-1);
+    }
+    phase_mode = 1;
+}
+
+/*
+ * Profiling pass.  A basic block ends at every branch or jump and wherever
+ * the PC is not the fall-through of the previous line.  Each interval gets a
+ * vector of instruction counts per block, hashed down to PHASE_DIMS
+ * dimensions (a random projection, as SimPoint does) and normalized.
+ * Returns the number of intervals.
+ */
+long iplc_sim_phase_profile(FILE *trace_file, double **bbv_out)
+{
+    char buffer[80], op[16];
+    unsigned int pc, prev_pc = 0, block_pc = 0;
+    int block_len = 0, ends_block = 1, d;
+    long line = 0, intervals = 0, allocated = 64, i;
+    double *bbv = (double *)calloc(allocated * PHASE_DIMS, sizeof(double));
+    
+    while (fgets(buffer, 80, trace_file) != NULL) {
+        if (sscanf(buffer, "%x %15s", &pc, op) != 2)
+            continue;
+        
+        if (line % phase_interval == 0 && line) {
+            // close the block at the interval boundary
+            if (block_len)
+                bbv[(intervals) * PHASE_DIMS + block_map_hash(block_pc) % PHASE_DIMS] += block_len;
+            block_len = 0;
+            intervals++;
+            if (intervals == allocated) {
+                allocated *= 2;
+                bbv = (double *)realloc(bbv, sizeof(double) * allocated * PHASE_DIMS);
+                bzero(bbv + intervals * PHASE_DIMS, sizeof(double) * (allocated - intervals) * PHASE_DIMS);
+            }
+        }
+        
+        if (ends_block || pc != prev_pc + 4) {
+            if (block_len)
+                bbv[intervals * PHASE_DIMS + block_map_hash(block_pc) % PHASE_DIMS] += block_len;
+            block_pc = pc;
+            block_len = 0;
+        }
+        block_len++;
+        
+        ends_block = (op[0] == 'b' || op[0] == 'j');
+        prev_pc = pc;
+        line++;
+    }
+    if (block_len)
+        bbv[intervals * PHASE_DIMS + block_map_hash(block_pc) % PHASE_DIMS] += block_len;
+    if (line)
+        intervals++;
+    
+    for (i = 0; i < intervals; i++) {
+        double sum = 0;
+        for (d = 0; d < PHASE_DIMS; d++)
+            sum += bbv[i * PHASE_DIMS + d];
+        for (d = 0; d < PHASE_DIMS && sum > 0; d++)
+            bbv[i * PHASE_DIMS + d] /= sum;
+    }
+    
+    *bbv_out = bbv;
+    return intervals;
+}
+
+double iplc_sim_phase_distance(double *a, double *b)
+{
+    double dist = 0;
+    int d;
+    
+    for (d = 0; d < PHASE_DIMS; d++)
+        dist += (a[d] - b[d]) * (a[d] - b[d]);
+    return dist;
+}
+
+/*
+ * Lloyd's k-means seeded with farthest-point picks, so the result is
+ * deterministic.  Returns the total squared distance to the centroids.
+ */
+double iplc_sim_phase_kmeans(double *bbv, long n, int k, int *cluster, double *centroid)
+{
+    long i, far = 0;
+    int c, d, iter, changed = 1;
+    double best, dist, sse = 0, *nearest = (double *)malloc(sizeof(double) * n);
+    long *members = (long *)malloc(sizeof(long) * k);
+    
+    memcpy(centroid, bbv, sizeof(double) * PHASE_DIMS);
+    for (i = 0; i < n; i++)
+        nearest[i] = iplc_sim_phase_distance(bbv + i * PHASE_DIMS, centroid);
+    for (c = 1; c < k; c++) {
+        for (i = 0; i < n; i++)
+            if (nearest[i] > nearest[far])
+                far = i;
+        memcpy(centroid + c * PHASE_DIMS, bbv + far * PHASE_DIMS, sizeof(double) * PHASE_DIMS);
+        for (i = 0; i < n; i++) {
+            dist = iplc_sim_phase_distance(bbv + i * PHASE_DIMS, centroid + c * PHASE_DIMS);
+            if (dist < nearest[i])
+                nearest[i] = dist;
+        }
+    }
+    
+    for (i = 0; i < n; i++)
+        cluster[i] = -1;
+    
+    for (iter = 0; iter < 100 && changed; iter++) {
+        changed = 0;
+        sse = 0;
+        for (i = 0; i < n; i++) {
+            int pick = 0;
+            best = iplc_sim_phase_distance(bbv + i * PHASE_DIMS, centroid);
+            for (c = 1; c < k; c++) {
+                dist = iplc_sim_phase_distance(bbv + i * PHASE_DIMS, centroid + c * PHASE_DIMS);
+                if (dist < best) {
+                    best = dist;
+                    pick = c;
+                }
+            }
+            if (cluster[i] != pick) {
+                cluster[i] = pick;
+                changed = 1;
+            }
+            sse += best;
+        }
+        
+        bzero(centroid, sizeof(double) * k * PHASE_DIMS);
+        bzero(members, sizeof(long) * k);
+        for (i = 0; i < n; i++) {
+            members[cluster[i]]++;
+            for (d = 0; d < PHASE_DIMS; d++)
+                centroid[cluster[i] * PHASE_DIMS + d] += bbv[i * PHASE_DIMS + d];
+        }
+        for (c = 0; c < k; c++)
+            for (d = 0; d < PHASE_DIMS && members[c]; d++)
+                centroid[c * PHASE_DIMS + d] /= members[c];
+    }
+    
+    free(nearest);
+    free(members);
+    return sse;
+}
+
+/*
+ * Bayesian information criterion of a clustering under the spherical
+ * Gaussian model used by X-means and SimPoint.
+ */
+double iplc_sim_phase_bic(long n, int k, int *cluster, double sse)
+{
+    double variance, bic = 0, params;
+    long *members = (long *)calloc(k, sizeof(long)), i;
+    int c;
+    
+    if (n <= k || sse <= 0) {
+        free(members);
+        return 0;
+    }
+    
+    variance = sse / (double)(PHASE_DIMS * (n - k));
+    for (i = 0; i < n; i++)
+        members[cluster[i]]++;
+    for (c = 0; c < k; c++) {
+        if (members[c] == 0)
+            continue;
+        bic += members[c] * log((double)members[c]) - members[c] * log((double)n)
+             - members[c] * PHASE_DIMS / 2.0 * log(2 * M_PI * variance)
+             - (members[c] - 1) * PHASE_DIMS / 2.0;
+    }
+    params = (k - 1) + k * PHASE_DIMS + 1;
+    bic -= params / 2.0 * log((double)n);
+    
+    free(members);
+    return bic;
+}
+
+/*
+ * Profile, cluster, then simulate one representative interval per phase in
+ * detail.  Everything else is skipped except for phase_warm lines of
+ * functional warming in front of each representative.  Whole program CPI and
+ * miss rate are the phase results weighted by how many intervals each phase
+ * covers.
+ */
+void iplc_sim_phase_run(FILE *trace_file)
+{
+    char buffer[80];
+    double *bbv, *centroid, *bic, best_bic, worst_bic, dist, best;
+    double cycles = 0, insts = 0, accesses = 0, misses = 0;
+    long n, i, line, interval, detailed = 0;
+    long *rep, *weight, *rep_cycles, *rep_insts, *rep_access, *rep_miss;
+    long cycles0 = 0, insts0 = 0, access0 = 0, miss0 = 0;
+    int *cluster, k, best_k = 1, c, maxk;
+    
+    trace_output = 0;
+    dump_pipeline = 0;
+    
+    n = iplc_sim_phase_profile(trace_file, &bbv);
+    if (n == 0) {
+        printf("Empty trace \n");
+        exit(-1);
+    }
+    
+    maxk = phase_maxk < n ? phase_maxk : (int) n;
+    cluster = (int *)malloc(sizeof(int) * n);
+    centroid = (double *)malloc(sizeof(double) * maxk * PHASE_DIMS);
+    bic = (double *)malloc(sizeof(double) * (maxk + 1));
+    
+    // smallest k that gets 90% of the way to the best score, as SimPoint does
+    for (k = 1; k <= maxk; k++)
+        bic[k] = iplc_sim_phase_bic(n, k, cluster, iplc_sim_phase_kmeans(bbv, n, k, cluster, centroid));
+    best_bic = worst_bic = bic[1];
+    for (k = 2; k <= maxk; k++) {
+        if (bic[k] > best_bic)
+            best_bic = bic[k];
+        if (bic[k] < worst_bic)
+            worst_bic = bic[k];
+    }
+    for (k = 1; k <= maxk; k++) {
+        if (bic[k] >= worst_bic + 0.9 * (best_bic - worst_bic)) {
+            best_k = k;
+            break;
+        }
+    }
+    iplc_sim_phase_kmeans(bbv, n, best_k, cluster, centroid);
+    
+    rep = (long *)malloc(sizeof(long) * best_k);
+    weight = (long *)calloc(best_k, sizeof(long));
+    rep_cycles = (long *)calloc(best_k, sizeof(long));
+    rep_insts = (long *)calloc(best_k, sizeof(long));
+    rep_access = (long *)calloc(best_k, sizeof(long));
+    rep_miss = (long *)calloc(best_k, sizeof(long));
+    
+    for (c = 0; c < best_k; c++) {
+        rep[c] = -1;
+        best = 0;
+        for (i = 0; i < n; i++) {
+            if (cluster[i] != c)
+                continue;
+            weight[c]++;
+            dist = iplc_sim_phase_distance(bbv + i * PHASE_DIMS, centroid + c * PHASE_DIMS);
+            if (rep[c] == -1 || dist < best) {
+                rep[c] = i;
+                best = dist;
+            }
+        }
+    }
+    
+    iplc_sim_reset();
+    rewind(trace_file);
+    
+    for (line = 0; fgets(buffer, 80, trace_file) != NULL; line++) {
+        long next_start = -1;
+        
+        interval = line / phase_interval;
+        for (c = 0; c < best_k; c++)
+            if (rep[c] == interval)
+                break;
+        
+        if (c < best_k) {
+            if (line % phase_interval == 0) {
+                cycles0 = pipeline_cycles;
+                insts0 = instruction_count;
+                access0 = cache_access;
+                miss0 = cache_miss;
+            }
+            iplc_sim_parse_instruction(buffer);
+            detailed++;
+            if ((line + 1) % phase_interval == 0 || line + 1 == n * phase_interval) {
+                rep_cycles[c] = pipeline_cycles - cycles0;
+                rep_insts[c] = instruction_count - insts0;
+                rep_access[c] = cache_access - access0;
+                rep_miss[c] = cache_miss - miss0;
+            }
+            continue;
+        }
+        
+        // warm only just ahead of the next representative
+        for (c = 0; c < best_k; c++)
+            if (rep[c] > interval && (next_start == -1 || rep[c] * phase_interval < next_start))
+                next_start = rep[c] * phase_interval;
+        if (next_start != -1 && line >= next_start - phase_warm) {
+            warming = 1;
+            iplc_sim_warm_instruction(buffer);
+            warming = 0;
+        }
+    }
+    // a representative at the end of the trace has no full interval
+    for (c = 0; c < best_k; c++) {
+        if (rep_insts[c] == 0 && rep[c] == n - 1) {
+            rep_cycles[c] = pipeline_cycles - cycles0;
+            rep_insts[c] = instruction_count - insts0;
+            rep_access[c] = cache_access - access0;
+            rep_miss[c] = cache_miss - miss0;
+        }
+    }
+    
+    printf(" Phase Analysis \n");
+    printf("\t Intervals is %ld of %ld lines \n", n, phase_interval);
+    printf("\t Phases is %d \n", best_k);
+    printf("\t %-8s %10s %14s %12s %12s \n", "Phase", "Weight", "Representative", "CPI", "Miss Rate");
+    for (c = 0; c < best_k; c++) {
+        double w = (double)weight[c] / (double)n;
+        
+        printf("\t %-8d %10f %14ld %12f %12f \n", c, w, rep[c],
+               rep_insts[c] ? (double)rep_cycles[c] / rep_insts[c] : 0.0,
+               rep_access[c] ? (double)rep_miss[c] / rep_access[c] : 0.0);
+        cycles += w * rep_cycles[c];
+        insts += w * rep_insts[c];
+        accesses += w * rep_access[c];
+        misses += w * rep_miss[c];
+    }
+    printf("\t Detailed Fraction is %f \n", (double)detailed / (double)line);
+    printf("\t Weighted Cache Miss Rate is %f \n", misses / accesses);
+    printf("\t Weighted CPI is %f \n\n", cycles / insts);
+    
+    free(bbv);
+    free(cluster);
+    free(centroid);
+    free(bic);
+    free(rep);
+    free(weight);
+    free(rep_cycles);
+    free(rep_insts);
+    free(rep_access);
+    free(rep_miss);
+}
+
+/************************************************************************************************/
+/* Parallel Functions ***************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Parse a comma separated list such as "chunks=4,warm=2000,verify=1".
+ */
+void iplc_sim_parallel_configure(char *spec)
+{
+    char *opt, key[32], value[32];
+    
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (sscanf(opt, "%31[^=]=%31s", key, value) != 2) {
+            printf("Unknown parallel option: %s \n", opt);
+            exit(-1);
+        }
+        
+        if (strcmp(key, "chunks") == 0)
+            parallel_chunks = atoi(value);
+        else if (strcmp(key, "warm") == 0)
+            parallel_warm = atol(value);
+        else if (strcmp(key, "verify") == 0)
+            parallel_verify = atoi(value);
+        else {
+            printf("Unknown parallel option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    
+    if (parallel_chunks < 1 || parallel_chunks > MAX_CHUNKS || parallel_warm < 0) {
+        printf("Bad parallel configuration \n");
+        exit(-1);
+    }
+}
+
+void iplc_sim_get_counters(sim_counters_t *counters)
+{
+    counters->cache_access = cache_access;
+    counters->cache_miss = cache_miss;
+    counters->cache_hit = cache_hit;
+    counters->pipeline_cycles = pipeline_cycles;
+    counters->instruction_count = instruction_count;
+    counters->branch_count = branch_count;
+    counters->correct_branch_predictions = correct_branch_predictions;
+}
+
+/*
+ * Simulate the next line of a chunk from either kind of trace.  Returns 0
+ * at the end of the trace.
+ */
+int iplc_sim_parallel_line(FILE *trace_file)
+{
+    char buffer[80];
+    decoded_instruction_t decoded;
+    
+    if (ztrace_mode) {
+        if (!iplc_sim_ztrace_next(&decoded))
+            return 0;
+        iplc_sim_execute_instruction(&decoded);
+        return 1;
+    }
+    if (fgets(buffer, 80, trace_file) == NULL)
+        return 0;
+    iplc_sim_parse_instruction(buffer);
+    return 1;
+}
+
+/*
+ * Worker for one chunk: simulate warm lines from a cold state, then count
+ * only the chunk's own lines.  The last chunk also drains the pipeline.
+ * The offset is a file position in a text trace and a line number in a
+ * compressed one.
+ */
+void iplc_sim_parallel_chunk(char *trace_file_name, long offset, long warm, long lines,
+                             int last, int fd)
+{
+    FILE *trace_file = NULL;
+    sim_counters_t start, end;
+    long line;
+    
+    // a compressed trace is opened again so the workers do not share a file position
+    if (ztrace_mode) {
+        if (!iplc_sim_ztrace_open(trace_file_name))
+            _exit(1);
+        iplc_sim_ztrace_seek(offset);
+    }
+    else if ((trace_file = fopen(trace_file_name, "r")) == NULL || fseek(trace_file, offset, SEEK_SET) != 0)
+        _exit(1);
+    
+    iplc_sim_reset();
+    for (line = 0; line < warm && iplc_sim_parallel_line(trace_file); line++)
+        ;
+    
+    iplc_sim_get_counters(&start);
+    for (line = 0; line < lines && iplc_sim_parallel_line(trace_file); line++)
+        ;
+    if (last)
+        iplc_sim_drain_pipeline();
+    iplc_sim_get_counters(&end);
+    
+    end.cache_access -= start.cache_access;
+    end.cache_miss -= start.cache_miss;
+    end.cache_hit -= start.cache_hit;
+    end.pipeline_cycles -= start.pipeline_cycles;
+    end.instruction_count -= start.instruction_count;
+    end.branch_count -= start.branch_count;
+    end.correct_branch_predictions -= start.correct_branch_predictions;
+    
+    if (write(fd, &end, sizeof(end)) != sizeof(end))
+        _exit(1);
+    _exit(0);
+}
+
+void iplc_sim_parallel_compare(char *name, double serial, double parallel)
+{
+    printf("\t %-24s %14.6f %14.6f %12f \n", name, serial, parallel,
+           serial ? (parallel - serial) / serial : 0.0);
+}
+
+/*
+ * Cut the trace into parallel_chunks pieces and simulate each in its own
+ * forked process.  All simulator state is process global, so a process per
+ * chunk gives each worker a private copy of it for free.  With verify the
+ * exact serial run goes in one more process alongside them, and the report
+ * shows how far the merged counters are off.
+ */
+void iplc_sim_parallel_run(FILE *trace_file, char *trace_file_name)
+{
+    char buffer[80];
+    long lines = 0, line = 0, chunk_lines, first[MAX_CHUNKS + 1], offset[MAX_CHUNKS];
+    long warm[MAX_CHUNKS];
+    pid_t pid;
+    int k, fds[MAX_CHUNKS + 1][2], workers = parallel_chunks + (parallel_verify ? 1 : 0);
+    sim_counters_t part, sum, serial;
+    
+    trace_output = 0;
+    dump_pipeline = 0;
+    
+    if (ztrace_mode)
+        lines = ztrace_header.lines;
+    else
+        while (fgets(buffer, 80, trace_file) != NULL)
+            lines++;
+    chunk_lines = (lines + parallel_chunks - 1) / parallel_chunks;
+    
+    // each worker starts parallel_warm lines ahead of its chunk
+    for (k = 0; k < parallel_chunks; k++) {
+        first[k] = k * chunk_lines;
+        warm[k] = first[k] < parallel_warm ? first[k] : parallel_warm;
+    }
+    first[parallel_chunks] = lines;
+    
+    rewind(trace_file);
+    for (k = 0; k < parallel_chunks; k++) {
+        if (ztrace_mode) {
+            // the index finds any line without reading up to it
+            offset[k] = first[k] - warm[k];
+            continue;
+        }
+        while (line < first[k] - warm[k] && fgets(buffer, 80, trace_file) != NULL)
+            line++;
+        offset[k] = ftell(trace_file);
+    }
+    
+    fflush(stdout);
+    for (k = 0; k < workers; k++) {
+        if (pipe(fds[k]) != 0) {
+            printf("pipe failed \n");
+            exit(-1);
+        }
+        pid = fork();
+        if (pid < 0) {
+            printf("fork failed \n");
+            exit(-1);
+        }
+        if (pid == 0) {
+            close(fds[k][0]);
+            if (k == parallel_chunks)
+                iplc_sim_parallel_chunk(trace_file_name, 0, 0, lines, 1, fds[k][1]);
+            else
+                iplc_sim_parallel_chunk(trace_file_name, offset[k], warm[k],
+                                        (k + 1 < parallel_chunks ? first[k+1] : lines) - first[k],
+                                        k == parallel_chunks - 1, fds[k][1]);
+        }
+        close(fds[k][1]);
+    }
+    
+    bzero(&sum, sizeof(sum));
+    bzero(&serial, sizeof(serial));
+    for (k = 0; k < workers; k++) {
+        if (read(fds[k][0], &part, sizeof(part)) != sizeof(part)) {
+            printf("Parallel worker %d failed \n", k);
+            exit(-1);
+        }
+        close(fds[k][0]);
+        if (k == parallel_chunks) {
+            serial = part;
+            continue;
+        }
+        sum.cache_access += part.cache_access;
+        sum.cache_miss += part.cache_miss;
+        sum.cache_hit += part.cache_hit;
+        sum.pipeline_cycles += part.pipeline_cycles;
+        sum.instruction_count += part.instruction_count;
+        sum.branch_count += part.branch_count;
+        sum.correct_branch_predictions += part.correct_branch_predictions;
+    }
+    while (wait(NULL) > 0)
+        ;
+    
+    printf(" Parallel Simulation \n");
+    printf("\t Chunks is %d of %ld lines, Warm-up is %ld lines \n\n",
+           parallel_chunks, chunk_lines, parallel_warm);
+    
+    cache_access = sum.cache_access;
+    cache_miss = sum.cache_miss;
+    cache_hit = sum.cache_hit;
+    pipeline_cycles = sum.pipeline_cycles;
+    instruction_count = sum.instruction_count;
+    branch_count = sum.branch_count;
+    correct_branch_predictions = sum.correct_branch_predictions;
+    iplc_sim_finalize();
+    
+    if (parallel_verify) {
+        printf(" Divergence From Serial Run \n");
+        printf("\t %-24s %14s %14s %12s \n", "Metric", "Serial", "Parallel", "Rel. Error");
+        iplc_sim_parallel_compare("Cache Misses", serial.cache_miss, sum.cache_miss);
+        iplc_sim_parallel_compare("Cache Miss Rate",
+                                  (double)serial.cache_miss / serial.cache_access,
+                                  (double)sum.cache_miss / sum.cache_access);
+        iplc_sim_parallel_compare("Total Cycles", serial.pipeline_cycles, sum.pipeline_cycles);
+        iplc_sim_parallel_compare("Total Instructions", serial.instruction_count, sum.instruction_count);
+        iplc_sim_parallel_compare("CPI",
+                                  (double)serial.pipeline_cycles / serial.instruction_count,
+                                  (double)sum.pipeline_cycles / sum.instruction_count);
+        printf("\n");
+    }
+}
+
+/************************************************************************************************/
+/* Multi-Configuration Functions ****************************************************************/
+/************************************************************************************************/
+
+/*
+ * Lanes are cache geometries that share the block size.  All lanes keep
+ * their ways in one tag array and one stamp array so a vector gather can
+ * read the same way of every lane's set at once.  Tags are stored plus one
+ * so 0 means invalid.  LRU is kept as last-use stamps instead of the
+ * replacement list; with ties going to the lowest way it evicts exactly the
+ * line iplc_sim_LRU_replace_on_miss() would.
+ */
+
+/*
+ * Parse a list such as "3:1,1:4,verify" of extra index:assoc lanes.  The
+ * geometry given at the prompt is always lane 0.
+ */
+void iplc_sim_multi_configure(char *spec)
+{
+    char *opt;
+    int index, assoc;
+    
+    multi_lanes = 1;
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (strcmp(opt, "verify") == 0)
+            multi_verify = 1;
+        else if (strcmp(opt, "isa=scalar") == 0)
+            multi_isa = 0;
+        else if (strcmp(opt, "isa=avx2") == 0)
+            multi_isa = 2;
+        else if (strcmp(opt, "isa=avx512") == 0)
+            multi_isa = 3;
+        else if (sscanf(opt, "%d:%d", &index, &assoc) == 2 && index >= 0 && assoc >= 1) {
+            if (multi_lanes == MAX_LANES) {
+                printf("At most %d configurations \n", MAX_LANES);
+                exit(-1);
+            }
+            multi_index[multi_lanes] = index;
+            multi_assoc[multi_lanes] = assoc;
+            multi_lanes++;
+        }
+        else {
+            printf("Unknown multi-configuration option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    multi_mode = 1;
+}
+
+/*
+ * Rank the stamps of every set 1..assoc so the clock can start over without
+ * changing any LRU order.
+ */
+void iplc_sim_multi_renumber()
+{
+    int lane, set, w, v;
+    int rank[MAX_LANE_WAYS];
+    unsigned int base;
+    
+    for (lane = 0; lane < multi_lanes; lane++) {
+        for (set = 0; set < (1 << multi_index[lane]); set++) {
+            base = multi_base[lane] + set * multi_assoc[lane];
+            for (w = 0; w < multi_assoc[lane]; w++) {
+                rank[w] = 0;
+                if (multi_stamps[base + w] == 0)
+                    continue;
+                rank[w] = 1;
+                for (v = 0; v < multi_assoc[lane]; v++)
+                    if (multi_stamps[base + v] && multi_stamps[base + v] < multi_stamps[base + w])
+                        rank[w]++;
+            }
+            for (w = 0; w < multi_assoc[lane]; w++)
+                multi_stamps[base + w] = rank[w];
+        }
+    }
+    multi_now = MAX_LANE_WAYS;
+}
+
+/*
+ * Shared tail of every kernel: record the outcome of one lane.
+ */
+static inline void iplc_sim_multi_update(int lane, int set, int tag, int way, int victim_way)
+{
+    int slot = multi_base[lane] + set * multi_assoc[lane];
+    
+    if (way >= 0) {
+        multi_hits[lane]++;
+        multi_stamps[slot + way] = multi_now;
+    }
+    else {
+        multi_misses[lane]++;
+        multi_tags[slot + victim_way] = tag;
+        multi_stamps[slot + victim_way] = multi_now;
+    }
+}
+
+void iplc_sim_multi_access_scalar(unsigned int address)
+{
+    int lane, w, set, tag, slot, way, victim_way;
+    
+    if (++multi_now == 0x7fffffff)
+        iplc_sim_multi_renumber();
+    
+    for (lane = 0; lane < multi_lanes; lane++) {
+        set = (address >> multi_offset) & multi_mask[lane];
+        tag = (address >> multi_tag_shift[lane]) + 1;
+        slot = multi_base[lane] + set * multi_assoc[lane];
+        way = -1;
+        victim_way = 0;
+        
+        for (w = 0; w < multi_assoc[lane]; w++) {
+            if (multi_tags[slot + w] == tag)
+                way = w;
+            if (multi_stamps[slot + w] < multi_stamps[slot + victim_way])
+                victim_way = w;
+        }
+        iplc_sim_multi_update(lane, set, tag, way, victim_way);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * Eight lanes per step: set and tag with variable shifts, then one gather of
+ * tags and stamps per way.  A lane drops out of the way loop once it runs
+ * past its own associativity.
+ */
+__attribute__((target("avx2")))
+void iplc_sim_multi_access_avx2(unsigned int address)
+{
+    int group, lane;
+    int set[8], tag[8], way[8], victim_way[8];
+    
+    if (++multi_now == 0x7fffffff)
+        iplc_sim_multi_renumber();
+    
+    for (group = 0; group < multi_lanes; group += 8) {
+        __m256i addr = _mm256_set1_epi32(address);
+        __m256i lane_id = _mm256_add_epi32(_mm256_set1_epi32(group),
+                                           _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(multi_lanes), lane_id);
+        __m256i assoc = _mm256_loadu_si256((__m256i *)(multi_assoc + group));
+        __m256i vset = _mm256_and_si256(_mm256_srli_epi32(addr, multi_offset),
+                                        _mm256_loadu_si256((__m256i *)(multi_mask + group)));
+        __m256i vtag = _mm256_add_epi32(_mm256_srlv_epi32(addr,
+                                        _mm256_loadu_si256((__m256i *)(multi_tag_shift + group))),
+                                        _mm256_set1_epi32(1));
+        __m256i row = _mm256_add_epi32(_mm256_loadu_si256((__m256i *)(multi_base + group)),
+                                       _mm256_mullo_epi32(vset, assoc));
+        __m256i hit_way = _mm256_set1_epi32(-1);
+        __m256i low_way = _mm256_setzero_si256();
+        __m256i low_stamp = _mm256_set1_epi32(0x7fffffff);
+        int w;
+        
+        for (w = 0; w < multi_max_assoc; w++) {
+            __m256i vw = _mm256_set1_epi32(w);
+            __m256i in_way = _mm256_and_si256(active, _mm256_cmpgt_epi32(assoc, vw));
+            __m256i idx = _mm256_add_epi32(row, vw);
+            __m256i t = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), multi_tags, idx, in_way, 4);
+            __m256i s = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), multi_stamps, idx, in_way, 4);
+            __m256i match = _mm256_and_si256(in_way, _mm256_cmpeq_epi32(t, vtag));
+            __m256i older = _mm256_and_si256(in_way, _mm256_cmpgt_epi32(low_stamp, s));
+            
+            hit_way = _mm256_blendv_epi8(hit_way, vw, match);
+            low_way = _mm256_blendv_epi8(low_way, vw, older);
+            low_stamp = _mm256_blendv_epi8(low_stamp, s, older);
+        }
+        
+        _mm256_storeu_si256((__m256i *)set, vset);
+        _mm256_storeu_si256((__m256i *)tag, vtag);
+        _mm256_storeu_si256((__m256i *)way, hit_way);
+        _mm256_storeu_si256((__m256i *)victim_way, low_way);
+        for (lane = 0; lane < 8 && group + lane < multi_lanes; lane++)
+            iplc_sim_multi_update(group + lane, set[lane], tag[lane], way[lane], victim_way[lane]);
+    }
+}
+
+/*
+ * Sixteen lanes per step with mask registers, and the LRU and fill updates
+ * done with scatters instead of a scalar tail.
+ */
+__attribute__((target("avx512f")))
+void iplc_sim_multi_access_avx512(unsigned int address)
+{
+    int group;
+    
+    if (++multi_now == 0x7fffffff)
+        iplc_sim_multi_renumber();
+    
+    for (group = 0; group < multi_lanes; group += 16) {
+        __m512i addr = _mm512_set1_epi32(address);
+        __mmask16 active = (__mmask16)((multi_lanes - group >= 16) ? 0xffff :
+                                       (1u << (multi_lanes - group)) - 1);
+        __m512i assoc = _mm512_loadu_si512(multi_assoc + group);
+        __m512i vset = _mm512_and_si512(_mm512_srli_epi32(addr, multi_offset),
+                                        _mm512_loadu_si512(multi_mask + group));
+        __m512i vtag = _mm512_add_epi32(_mm512_srlv_epi32(addr, _mm512_loadu_si512(multi_tag_shift + group)),
+                                        _mm512_set1_epi32(1));
+        __m512i row = _mm512_add_epi32(_mm512_loadu_si512(multi_base + group),
+                                       _mm512_mullo_epi32(vset, assoc));
+        __m512i hit_way = _mm512_set1_epi32(-1);
+        __m512i low_way = _mm512_setzero_si512();
+        __m512i low_stamp = _mm512_set1_epi32(0x7fffffff);
+        __mmask16 hit;
+        __m512i slot;
+        int w;
+        
+        for (w = 0; w < multi_max_assoc; w++) {
+            __m512i vw = _mm512_set1_epi32(w);
+            __mmask16 in_way = active & _mm512_cmpgt_epi32_mask(assoc, vw);
+            __m512i idx = _mm512_add_epi32(row, vw);
+            __m512i t = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), in_way, idx, multi_tags, 4);
+            __m512i s = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), in_way, idx, multi_stamps, 4);
+            __mmask16 match = in_way & _mm512_cmpeq_epi32_mask(t, vtag);
+            __mmask16 older = in_way & _mm512_cmpgt_epi32_mask(low_stamp, s);
+            
+            hit_way = _mm512_mask_mov_epi32(hit_way, match, vw);
+            low_way = _mm512_mask_mov_epi32(low_way, older, vw);
+            low_stamp = _mm512_mask_mov_epi32(low_stamp, older, s);
+        }
+        
+        hit = active & _mm512_cmpge_epi32_mask(hit_way, _mm512_setzero_si512());
+        slot = _mm512_add_epi32(row, _mm512_mask_mov_epi32(low_way, hit, hit_way));
+        _mm512_mask_i32scatter_epi32(multi_stamps, active, slot, _mm512_set1_epi32(multi_now), 4);
+        _mm512_mask_i32scatter_epi32(multi_tags, active & ~hit, slot, vtag, 4);
+        
+        // per lane counters stay scalar, they are not on the lookup path
+        {
+            int lane;
+            for (lane = 0; lane < 16 && group + lane < multi_lanes; lane++) {
+                if (hit & (1 << lane))
+                    multi_hits[group + lane]++;
+                else
+                    multi_misses[group + lane]++;
+            }
+        }
+    }
+}
+#endif
+
+/*
+ * Lay out every lane and pick the widest kernel the host runs.
+ */
+void iplc_sim_multi_init()
+{
+    int lane;
+    unsigned int slots = 0;
+    
+    multi_index[0] = cache_index;
+    multi_assoc[0] = cache_assoc;
+    multi_offset = cache_blockoffsetbits;
+    multi_max_assoc = 0;
+    
+    for (lane = 0; lane < multi_lanes; lane++) {
+        if (iplc_sim_cache_size(multi_index[lane], cache_blocksize, multi_assoc[lane]) > MAX_CACHE_SIZE) {
+            printf("Cache %d:%d too big. Great than MAX SIZE of %d .... \n",
+                   multi_index[lane], multi_assoc[lane], MAX_CACHE_SIZE);
+            exit(-1);
+        }
+        multi_mask[lane] = (1 << multi_index[lane]) - 1;
+        multi_tag_shift[lane] = multi_offset + multi_index[lane];
+        multi_base[lane] = slots;
+        slots += (1 << multi_index[lane]) * multi_assoc[lane];
+        if (multi_assoc[lane] > multi_max_assoc)
+            multi_max_assoc = multi_assoc[lane];
+    }
+    if (multi_max_assoc > MAX_LANE_WAYS) {
+        printf("At most %d ways per configuration \n", MAX_LANE_WAYS);
+        exit(-1);
+    }
+    
+    multi_tags = (int *)calloc(slots, sizeof(int));
+    multi_stamps = (int *)calloc(slots, sizeof(int));
+    multi_now = 0;
+    
+    iplc_sim_multi_access = iplc_sim_multi_access_scalar;
+    multi_kernel = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    if (multi_isa >= 3 && __builtin_cpu_supports("avx512f")) {
+        iplc_sim_multi_access = iplc_sim_multi_access_avx512;
+        multi_kernel = "avx512";
+    }
+    else if (multi_isa >= 2 && __builtin_cpu_supports("avx2")) {
+        iplc_sim_multi_access = iplc_sim_multi_access_avx2;
+        multi_kernel = "avx2";
+    }
+#endif
+}
+
+/*
+ * Instruction address, then the data address of loads and stores, in trace
+ * order -- the same stream functional warming feeds iplc_sim_trap_address().
+ */
+int iplc_sim_trace_addresses(char *buffer, unsigned int *address)
+{
+    char op[16], *colon;
+    int n = 0;
+    
+    if (sscanf(buffer, "%x %15s", &address[0], op) != 2)
+        return 0;
+    n = 1;
+    if ((strcmp(op, "lw") == 0 || strcmp(op, "sw") == 0) &&
+        (colon = strchr(buffer, ':')) != NULL &&
+        sscanf(colon + 1, "%x", &address[1]) == 1)
+        n = 2;
+    return n;
+}
+
+void iplc_sim_multi_run(FILE *trace_file)
+{
+    char buffer[80];
+    unsigned int address[2];
+    long accesses = 0;
+    int lane, i, n;
+    
+    iplc_sim_multi_init();
+    
+    while (fgets(buffer, 80, trace_file) != NULL) {
+        n = iplc_sim_trace_addresses(buffer, address);
+        for (i = 0; i < n; i++)
+            iplc_sim_multi_access(address[i]);
+        accesses += n;
+    }
+    
+    // the lanes see loads and stores in trace order, the pipeline a few cycles later
+    printf(" Multi-Configuration Cache Performance (%s kernel, trace order stream) \n", multi_kernel);
+    printf("\t %-6s %-6s %10s %12s %12s %12s \n", "Index", "Assoc", "CacheSize",
+           "Accesses", "Misses", "Miss Rate");
+    for (lane = 0; lane < multi_lanes; lane++)
+        printf("\t %-6d %-6d %10lu %12ld %12ld %12f \n", multi_index[lane], multi_assoc[lane],
+               iplc_sim_cache_size(multi_index[lane], cache_blocksize, multi_assoc[lane]),
+               accesses, multi_misses[lane], (double)multi_misses[lane] / (double)accesses);
+    printf("\t These are miss counts of the trace order address stream, not the pipeline's \n\n");
+    
+    if (!multi_verify)
+        return;
+    
+    /*
+     * Replay each lane through the real cache code twice: fed the same
+     * trace order stream, which must match the lane exactly, and through
+     * the pipeline, whose fetches and data accesses interleave differently.
+     * The difference to the second is what the lanes do not model.
+     */
+    trace_output = 0;
+    dump_pipeline = 0;
+    printf(" Multi-Configuration Verification \n");
+    printf("\t %-6s %-6s %12s %10s %12s %12s \n", "Index", "Assoc", "Stream", "Lane",
+           "Pipeline", "Difference");
+    for (lane = 0; lane < multi_lanes; lane++) {
+        long stream_miss;
+        
+        iplc_sim_build_cache(multi_index[lane], multi_assoc[lane]);
+        iplc_sim_reset();
+        rewind(trace_file);
+        while (fgets(buffer, 80, trace_file) != NULL)
+            iplc_sim_warm_instruction(buffer);
+        stream_miss = cache_miss;
+        
+        iplc_sim_reset();
+        rewind(trace_file);
+        while (fgets(buffer, 80, trace_file) != NULL)
+            iplc_sim_parse_instruction(buffer);
+        iplc_sim_drain_pipeline();
+        
+        printf("\t %-6d %-6d %12ld %10s %12ld %+12ld \n", multi_index[lane], multi_assoc[lane],
+               stream_miss, stream_miss == multi_misses[lane] ? "matches" : "MISMATCH",
+               cache_miss, multi_misses[lane] - cache_miss);
+    }
+    printf("\n");
+}
+
+/************************************************************************************************/
+/* Exploration Functions ************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Every geometry whose iplc_sim_cache_size() fits the budget is a
+ * candidate.  Miss counts for all of them come from one pass per index and
+ * block size, which covers every associativity at once.  Those passes see
+ * the addresses in trace order, not in the order the pipeline sends them
+ * to the cache, so they only estimate the misses a run reports.
+ * A geometry is run through the pipeline when no geometry of the same or
+ * smaller size misses less by more than the slack; for CPI because miss
+ * cycles dominate it, for the miss rate because the estimate is close.
+ * The frontier is drawn from those runs under either objective.
+ */
+
+/*
+ * Parse a list such as "budget=8192,objective=miss,slack=0.1,verify".
+ */
+void iplc_sim_explore_configure(char *spec)
+{
+    char *opt;
+    
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (strncmp(opt, "budget=", 7) == 0)
+            explore_budget = strtoul(opt + 7, NULL, 10);
+        else if (strcmp(opt, "objective=cpi") == 0)
+            explore_cpi = 1;
+        else if (strcmp(opt, "objective=miss") == 0)
+            explore_cpi = 0;
+        else if (strncmp(opt, "slack=", 6) == 0)
+            explore_slack = atof(opt + 6);
+        else if (strcmp(opt, "verify") == 0)
+            explore_verify = 1;
+        else {
+            printf("Unknown exploration option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    if (explore_budget < 1 || explore_budget > MAX_CACHE_SIZE || explore_slack < 0) {
+        printf("Exploration needs a budget of 1 to %d bits and a slack of at least 0 \n", MAX_CACHE_SIZE);
+        exit(-1);
+    }
+    explore_mode = 1;
+}
+
+void iplc_sim_explore_add(int index, int blocksize, int assoc)
+{
+    explore_point_t *p;
+    
+    if (explore_points % 256 == 0)
+        explore_point = realloc(explore_point, sizeof(explore_point_t) * (explore_points + 256));
+    p = &explore_point[explore_points++];
+    bzero(p, sizeof(explore_point_t));
+    p->index = index;
+    p->blocksize = blocksize;
+    p->assoc = assoc;
+    p->size = iplc_sim_cache_size(index, blocksize, assoc);
+}
+
+/*
+ * Block sizes are powers of two so the offset bits come out whole.  The
+ * size grows with each of the three parameters, so each loop stops at the
+ * first geometry over the budget.
+ */
+void iplc_sim_explore_enumerate()
+{
+    int index, blocksize, assoc;
+    
+    for (blocksize = 1; iplc_sim_cache_size(0, blocksize, 1) <= explore_budget; blocksize *= 2)
+        for (index = 0; iplc_sim_cache_size(index, blocksize, 1) <= explore_budget; index++)
+            for (assoc = 1; iplc_sim_cache_size(index, blocksize, assoc) <= explore_budget; assoc++)
+                iplc_sim_explore_add(index, blocksize, assoc);
+}
+
+void iplc_sim_explore_blocksize(int blocksize)
+{
+    cache_blocksize = blocksize;
+    cache_blockoffsetbits = (int) rint((log( (double) (blocksize * 4) )/ log(2)));
+}
+
+/*
+ * LRU keeps the lines of a smaller associativity a subset of those of a
+ * larger one with the same sets, so an access hits in every cache with more
+ * ways than its depth in its set's recency stack.  One pass recording the
+ * depths gives the misses of all the associativities of an index and block
+ * size.  stack_hits[d] counts the accesses found at depth d.
+ */
+void iplc_sim_explore_curve(FILE *trace_file, int index, int blocksize, int depth, long *stack_hits,
+                            long *accesses)
+{
+    char buffer[80];
+    unsigned int address[2], block;
+    unsigned int *stack = (unsigned int *)calloc((size_t)depth << index, sizeof(unsigned int));
+    unsigned int *line;
+    int i, n, d;
+    
+    iplc_sim_explore_blocksize(blocksize);
+    bzero(stack_hits, sizeof(long) * depth);
+    *accesses = 0;
+    
+    rewind(trace_file);
+    while (fgets(buffer, 80, trace_file) != NULL) {
+        n = iplc_sim_trace_addresses(buffer, address);
+        for (i = 0; i < n; i++) {
+            // blocks are stored plus one so 0 is an empty slot
+            block = (address[i] >> cache_blockoffsetbits) + 1;
+            line = &stack[(size_t)((block - 1) & ((1 << index) - 1)) * depth];
+            for (d = 0; d < depth - 1 && line[d] != block && line[d] != 0; d++)
+                ;
+            if (line[d] == block)
+                stack_hits[d]++;
+            memmove(&line[1], &line[0], sizeof(unsigned int) * d);
+            line[0] = block;
+        }
+        *accesses += n;
+    }
+    free(stack);
+    explore_passes++;
+}
+
+/*
+ * Full pipeline run of one geometry.
+ */
+void iplc_sim_explore_simulate(FILE *trace_file, explore_point_t *p)
+{
+    char buffer[80];
+    
+    iplc_sim_explore_blocksize(p->blocksize);
+    iplc_sim_build_cache(p->index, p->assoc);
+    iplc_sim_reset();
+    rewind(trace_file);
+    while (fgets(buffer, 80, trace_file) != NULL)
+        iplc_sim_parse_instruction(buffer);
+    iplc_sim_drain_pipeline();
+    
+    p->run.cache_access = cache_access;
+    p->run.cache_miss = cache_miss;
+    p->run.cache_hit = cache_hit;
+    p->run.pipeline_cycles = pipeline_cycles;
+    p->run.instruction_count = instruction_count;
+    p->run.branch_count = branch_count;
+    p->run.correct_branch_predictions = correct_branch_predictions;
+    p->simulated = 1;
+    explore_simulations++;
+}
+
+double iplc_sim_explore_value(explore_point_t *p)
+{
+    if (explore_cpi)
+        return (double)p->run.pipeline_cycles / (double)p->run.instruction_count;
+    return (double)p->run.cache_miss / (double)p->run.cache_access;
+}
+
+/*
+ * Mark the points no other point beats on size and objective both.  Only
+ * points with a full run take part, or only the ones the pruned search
+ * would have run when candidates_only is set.
+ */
+void iplc_sim_explore_frontier(int *on_frontier, int candidates_only)
+{
+    explore_point_t *p, *q;
+    int i, j;
+    
+    for (i = 0; i < explore_points; i++) {
+        p = &explore_point[i];
+        on_frontier[i] = candidates_only ? p->candidate : p->simulated;
+        for (j = 0; j < explore_points && on_frontier[i]; j++) {
+            q = &explore_point[j];
+            if (!(candidates_only ? q->candidate : q->simulated))
+                continue;
+            if (q->size <= p->size && iplc_sim_explore_value(q) <= iplc_sim_explore_value(p) &&
+                (q->size < p->size || iplc_sim_explore_value(q) < iplc_sim_explore_value(p)))
+                on_frontier[i] = 0;
+        }
+    }
+}
+
+int iplc_sim_explore_compare(const void *a, const void *b)
+{
+    const explore_point_t *p = a, *q = b;
+    
+    if (p->size != q->size)
+        return p->size < q->size ? -1 : 1;
+    if (p->blocksize != q->blocksize)
+        return p->blocksize - q->blocksize;
+    return p->index - q->index;
+}
+
+void iplc_sim_explore_run(FILE *trace_file)
+{
+    explore_point_t *p, *q;
+    long *stack_hits, accesses, hits;
+    int *on_frontier, *found;
+    int frontier = 0, missing = 0;
+    int i, j, k, depth;
+    
+    // only the table at the end is of interest
+    trace_output = 0;
+    dump_pipeline = 0;
+    
+    iplc_sim_explore_enumerate();
+    
+    // the associativities of one index and block size are contiguous, widest last
+    for (i = 0; i < explore_points; i = j) {
+        for (j = i; j < explore_points && explore_point[j].index == explore_point[i].index &&
+             explore_point[j].blocksize == explore_point[i].blocksize; j++)
+            ;
+        depth = explore_point[j - 1].assoc;
+        stack_hits = (long *)malloc(sizeof(long) * depth);
+        iplc_sim_explore_curve(trace_file, explore_point[i].index, explore_point[i].blocksize,
+                               depth, stack_hits, &accesses);
+        for (k = i, hits = 0; k < j; k++) {
+            p = &explore_point[k];
+            hits += stack_hits[p->assoc - 1];
+            p->accesses = accesses;
+            p->misses = accesses - hits;
+        }
+        free(stack_hits);
+    }
+    
+    qsort(explore_point, explore_points, sizeof(explore_point_t), iplc_sim_explore_compare);
+    
+    for (i = 0; i < explore_points; i++) {
+        p = &explore_point[i];
+        p->candidate = 1;
+        for (j = 0; j < explore_points && p->candidate; j++) {
+            q = &explore_point[j];
+            if (q->size <= p->size && q->misses * (1.0 + explore_slack) < p->misses)
+                p->candidate = 0;
+        }
+        if (p->candidate || explore_verify)
+            iplc_sim_explore_simulate(trace_file, p);
+    }
+    
+    on_frontier = (int *)malloc(sizeof(int) * explore_points);
+    iplc_sim_explore_frontier(on_frontier, 0);
+    
+    printf(" Design Space Exploration \n");
+    printf("\t Size Budget is %lu \n", explore_budget);
+    printf("\t Objective is %s \n", explore_cpi ? "CPI" : "Miss Rate");
+    printf("\t Legal Geometries is %d \n", explore_points);
+    printf("\t Trace Passes for Miss Counts is %d \n", explore_passes);
+    printf("\t Full Pipeline Runs is %d \n\n", explore_simulations);
+    
+    printf(" Pareto Frontier \n");
+    printf("\t %-6s %-6s %-6s %10s %12s %12s", "Index", "Block", "Assoc", "CacheSize", "Misses", "Miss Rate");
+    printf(" %10s \n", explore_cpi ? "CPI" : "Estimate");
+    for (i = 0; i < explore_points; i++) {
+        p = &explore_point[i];
+        if (!on_frontier[i])
+            continue;
+        frontier++;
+        if (explore_cpi)
+            printf("\t %-6d %-6d %-6d %10lu %12ld %12f %10f \n", p->index, p->blocksize, p->assoc,
+                   p->size, p->run.cache_miss, (double)p->run.cache_miss / (double)p->run.cache_access,
+                   iplc_sim_explore_value(p));
+        else
+            printf("\t %-6d %-6d %-6d %10lu %12ld %12f %10ld \n", p->index, p->blocksize, p->assoc,
+                   p->size, p->run.cache_miss, iplc_sim_explore_value(p), p->misses);
+    }
+    printf("\n");
+    
+    if (explore_verify) {
+        // every point was run, check the pruned search found the same frontier
+        found = (int *)malloc(sizeof(int) * explore_points);
+        iplc_sim_explore_frontier(found, 1);
+        for (i = 0; i < explore_points; i++)
+            if (on_frontier[i] && !found[i])
+                missing++;
+        printf(" Exploration Verification \n");
+        printf("\t Pruned search found %d of %d frontier points, %s \n\n",
+               frontier - missing, frontier, missing ? "MISMATCH" : "matches");
+        free(found);
+    }
+    free(on_frontier);
+}
+
+/************************************************************************************************/
+/* Checkpoint Functions *************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Save and restore walk the state through the same functions, so the two
+ * can never disagree on the layout.  The file is a raw dump and is only
+ * meant to be read back by the same build on the same host.
+ */
+void iplc_sim_checkpoint_io(FILE *fp, void *ptr, size_t size, int save)
+{
+    size_t done;
+    
+    if (size == 0)
+        return;
+    
+    done = save ? fwrite(ptr, size, 1, fp) : fread(ptr, size, 1, fp);
+    if (done != 1) {
+        printf("Checkpoint %s failed \n", save ? "write" : "read");
+        exit(-1);
+    }
+}
+
+void iplc_sim_checkpoint_block_map(FILE *fp, block_map_t *map, int save)
+{
+    iplc_sim_checkpoint_io(fp, &map->mask, sizeof(map->mask), save);
+    iplc_sim_checkpoint_io(fp, &map->count, sizeof(map->count), save);
+    if (!save) {
+        free(map->key);
+        free(map->val);
+        map->key = (unsigned int *)malloc(sizeof(unsigned int) * (map->mask + 1));
+        map->val = (long *)malloc(sizeof(long) * (map->mask + 1));
+    }
+    iplc_sim_checkpoint_io(fp, map->key, sizeof(unsigned int) * (map->mask + 1), save);
+    iplc_sim_checkpoint_io(fp, map->val, sizeof(long) * (map->mask + 1), save);
+}
+
+/*
+ * Everything iplc_sim_init() allocated plus every counter.  The cache
+ * geometry and enabled features must already match, which the header
+ * takes care of.
+ */
+void iplc_sim_checkpoint_state(FILE *fp, int save)
+{
+    int i;
+    
+    iplc_sim_block_flush();
+    fast_valid = 0;
+    for (i = 0; i < (1<<cache_index); i++) {
+        iplc_sim_checkpoint_io(fp, cache[i].assoc, sizeof(assoc_t) * cache_assoc, save);
+        iplc_sim_checkpoint_io(fp, cache[i].replacement, sizeof(int) * cache_assoc, save);
+    }
+    iplc_sim_checkpoint_io(fp, &cache_miss, sizeof(cache_miss), save);
+    iplc_sim_checkpoint_io(fp, &cache_access, sizeof(cache_access), save);
+    iplc_sim_checkpoint_io(fp, &cache_hit, sizeof(cache_hit), save);
+    iplc_sim_checkpoint_io(fp, &miss_delay, sizeof(miss_delay), save);
+    
+    iplc_sim_checkpoint_io(fp, pipeline, sizeof(pipeline), save);
+    iplc_sim_checkpoint_io(fp, &pipeline_cycles, sizeof(pipeline_cycles), save);
+    iplc_sim_checkpoint_io(fp, &instruction_count, sizeof(instruction_count), save);
+    iplc_sim_checkpoint_io(fp, &branch_count, sizeof(branch_count), save);
+    iplc_sim_checkpoint_io(fp, &correct_branch_predictions, sizeof(correct_branch_predictions), save);
+    
+    if (victim_entries) {
+        iplc_sim_checkpoint_io(fp, victim, sizeof(victim_line_t) * victim_entries, save);
+        iplc_sim_checkpoint_io(fp, &victim_clock, sizeof(victim_clock), save);
+        iplc_sim_checkpoint_io(fp, &victim_hit, sizeof(victim_hit), save);
+    }
+    
+    if (dram_enabled) {
+        iplc_sim_checkpoint_io(fp, dram_bank, sizeof(dram_bank_t) * dram_banks, save);
+        iplc_sim_checkpoint_io(fp, dram_queue, sizeof(dram_queue), save);
+        iplc_sim_checkpoint_io(fp, &dram_queued, sizeof(dram_queued), save);
+        iplc_sim_checkpoint_io(fp, &dram_bus_ready, sizeof(dram_bus_ready), save);
+        iplc_sim_checkpoint_io(fp, &dram_requests, sizeof(dram_requests), save);
+        iplc_sim_checkpoint_io(fp, &dram_row_hits, sizeof(dram_row_hits), save);
+        iplc_sim_checkpoint_io(fp, &dram_row_misses, sizeof(dram_row_misses), save);
+        iplc_sim_checkpoint_io(fp, &dram_row_conflicts, sizeof(dram_row_conflicts), save);
+        iplc_sim_checkpoint_io(fp, &dram_bypasses, sizeof(dram_bypasses), save);
+        iplc_sim_checkpoint_io(fp, &dram_queue_full, sizeof(dram_queue_full), save);
+        iplc_sim_checkpoint_io(fp, &dram_latency, sizeof(dram_latency), save);
+    }
+    
+    if (classify_misses) {
+        iplc_sim_checkpoint_io(fp, &cache_miss_compulsory, sizeof(cache_miss_compulsory), save);
+        iplc_sim_checkpoint_io(fp, &cache_miss_capacity, sizeof(cache_miss_capacity), save);
+        iplc_sim_checkpoint_io(fp, &cache_miss_conflict, sizeof(cache_miss_conflict), save);
+        iplc_sim_checkpoint_block_map(fp, &seen_blocks, save);
+        iplc_sim_checkpoint_block_map(fp, &shadow_map, save);
+        iplc_sim_checkpoint_io(fp, shadow, sizeof(shadow_line_t) * shadow_size, save);
+        iplc_sim_checkpoint_io(fp, &shadow_used, sizeof(shadow_used), save);
+        iplc_sim_checkpoint_io(fp, &shadow_mru, sizeof(shadow_mru), save);
+        iplc_sim_checkpoint_io(fp, &shadow_lru, sizeof(shadow_lru), save);
+    }
+    
+    if (reuse_profile) {
+        iplc_sim_checkpoint_io(fp, &reuse_tree_size, sizeof(reuse_tree_size), save);
+        if (!save) {
+            free(reuse_tree);
+            reuse_tree = (long *)malloc(sizeof(long) * reuse_tree_size);
+        }
+        iplc_sim_checkpoint_io(fp, reuse_tree, sizeof(long) * reuse_tree_size, save);
+        iplc_sim_checkpoint_io(fp, &reuse_time, sizeof(reuse_time), save);
+        iplc_sim_checkpoint_block_map(fp, &reuse_last, save);
+        iplc_sim_checkpoint_io(fp, reuse_hist, sizeof(reuse_hist), save);
+        iplc_sim_checkpoint_io(fp, reuse_cold, sizeof(reuse_cold), save);
+    }
+}
+
+/*
+ * Configuration needed to rebuild the simulator before its state can be
+ * read back: trace position, cache geometry and which features are on.
+ */
+void iplc_sim_checkpoint_header(FILE *fp, char *trace_file_name, long *trace_offset, int save)
+{
+    char magic[8];
+    
+    memcpy(magic, CHECKPOINT_MAGIC, sizeof(magic));
+    iplc_sim_checkpoint_io(fp, magic, sizeof(magic), save);
+    if (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+        printf("Not a simulator checkpoint \n");
+        exit(-1);
+    }
+    
+    iplc_sim_checkpoint_io(fp, trace_file_name, 1024, save);
+    iplc_sim_checkpoint_io(fp, trace_offset, sizeof(*trace_offset), save);
+    iplc_sim_checkpoint_io(fp, &trace_line, sizeof(trace_line), save);
+    
+    iplc_sim_checkpoint_io(fp, &cache_index, sizeof(cache_index), save);
+    iplc_sim_checkpoint_io(fp, &cache_blocksize, sizeof(cache_blocksize), save);
+    iplc_sim_checkpoint_io(fp, &cache_assoc, sizeof(cache_assoc), save);
+    iplc_sim_checkpoint_io(fp, &branch_predict_taken, sizeof(branch_predict_taken), save);
+    
+    iplc_sim_checkpoint_io(fp, &victim_entries, sizeof(victim_entries), save);
+    iplc_sim_checkpoint_io(fp, &classify_misses, sizeof(classify_misses), save);
+    iplc_sim_checkpoint_io(fp, &reuse_profile, sizeof(reuse_profile), save);
+    iplc_sim_checkpoint_io(fp, &dram_enabled, sizeof(dram_enabled), save);
+    iplc_sim_checkpoint_io(fp, &dram_banks, sizeof(dram_banks), save);
+    iplc_sim_checkpoint_io(fp, &dram_row_bytes, sizeof(dram_row_bytes), save);
+    iplc_sim_checkpoint_io(fp, &dram_row_hit, sizeof(dram_row_hit), save);
+    iplc_sim_checkpoint_io(fp, &dram_row_miss, sizeof(dram_row_miss), save);
+    iplc_sim_checkpoint_io(fp, &dram_row_conflict, sizeof(dram_row_conflict), save);
+    iplc_sim_checkpoint_io(fp, &dram_bus_bytes, sizeof(dram_bus_bytes), save);
+    iplc_sim_checkpoint_io(fp, &dram_queue_depth, sizeof(dram_queue_depth), save);
+    iplc_sim_checkpoint_io(fp, &dram_frfcfs, sizeof(dram_frfcfs), save);
+}
+
+void iplc_sim_checkpoint_save(char *file_name, char *trace_file_name, long trace_offset)
+{
+    FILE *fp = fopen(file_name, "wb");
+    
+    if (fp == NULL) {
+        printf("fopen failed for %s file\n", file_name);
+        exit(-1);
+    }
+    
+    iplc_sim_checkpoint_header(fp, trace_file_name, &trace_offset, 1);
+    iplc_sim_checkpoint_state(fp, 1);
+    fclose(fp);
+    
+    printf("Checkpoint written to %s at trace line %ld \n", file_name, trace_line);
+}
+
+/*
+ * Rebuild the simulator from a checkpoint and return the trace file
+ * positioned at the first line not yet simulated.
+ */
+FILE *iplc_sim_checkpoint_restore(char *file_name, char *trace_file_name)
+{
+    FILE *fp, *trace_file;
+    long trace_offset = 0;
+    
+    fp = fopen(file_name, "rb");
+    if (fp == NULL) {
+        printf("fopen failed for %s file\n", file_name);
+        exit(-1);
+    }
+    
+    iplc_sim_checkpoint_header(fp, trace_file_name, &trace_offset, 0);
+    
+    trace_file = fopen(trace_file_name, "r");
+    if (trace_file == NULL || fseek(trace_file, trace_offset, SEEK_SET) != 0) {
+        printf("fopen failed for %s file\n", trace_file_name);
+        exit(-1);
+    }
+    
+    iplc_sim_init(cache_index, cache_blocksize, cache_assoc);
+    iplc_sim_checkpoint_state(fp, 0);
+    fclose(fp);
+    
+    printf("Restored %s at trace line %ld \n", file_name, trace_line);
+    return trace_file;
+}
+
+/************************************************************************************************/
+/* Results Functions ****************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Parse "json:file" or "csv:file".  Results are appended, one record per
+ * run, so a sweep can point every run at the same file.
+ */
+void iplc_sim_results_configure(char *spec)
+{
+    char *colon = strchr(spec, ':');
+    
+    if (colon == NULL || colon[1] == '\0') {
+        printf("Results must be given as json:file or csv:file \n");
+        exit(-1);
+    }
+    *colon = '\0';
+    if (strcmp(spec, "json") == 0)
+        results_format = RESULTS_JSON;
+    else if (strcmp(spec, "csv") == 0)
+        results_format = RESULTS_CSV;
+    else {
+        printf("Unknown results format: %s \n", spec);
+        exit(-1);
+    }
+    results_file = colon + 1;
+}
+
+double iplc_sim_wall_time()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Write the trace name as a JSON string or a CSV field.
+ */
+void iplc_sim_results_name(FILE *fp, char *name)
+{
+    char *p;
+    
+    fputc('"', fp);
+    for (p = name; *p; p++) {
+        if (*p == '"')
+            fputs(results_format == RESULTS_JSON ? "\\\"" : "\"\"", fp);
+        else if (*p == '\\' && results_format == RESULTS_JSON)
+            fputs("\\\\", fp);
+        else
+            fputc(*p, fp);
+    }
+    fputc('"', fp);
+}
+
+void iplc_sim_results_write()
+{
+    FILE *fp = fopen(results_file, "a");
+    
+    if (fp == NULL) {
+        printf("fopen failed for %s file\n", results_file);
+        exit(-1);
+    }
+    iplc_sim_results_record(fp);
+    fclose(fp);
+}
+
+/*
+ * One record with the whole configuration, every counter, the derived
+ * rates and how long the run took.  The CSV header is written only when
+ * the file is empty.
+ */
+void iplc_sim_results_record(FILE *fp)
+{
+    double seconds = iplc_sim_wall_time() - results_start;
+    unsigned long size = iplc_sim_cache_size(cache_index, cache_blocksize, cache_assoc);
+    double miss_rate = cache_access ? (double)cache_miss / (double)cache_access : 0.0;
+    double cpi = instruction_count ? (double)pipeline_cycles / (double)instruction_count : 0.0;
+    double accuracy = branch_count ? (double)correct_branch_predictions / (double)branch_count : 0.0;
+    double rate = seconds > 0.0 ? instruction_count / seconds : 0.0;
+    
+    if (results_format == RESULTS_JSON) {
+        fprintf(fp, "{\"trace\": ");
+        iplc_sim_results_name(fp, results_trace);
+        fprintf(fp, ", \"index\": %d, \"blocksize\": %d, \"assoc\": %d, "
+                "\"blockoffsetbits\": %d, \"cache_size\": %lu, \"predictor\": \"%s\", "
+                "\"miss_delay\": %d, \"victim_entries\": %d, \"dram\": %d, ",
+                cache_index, cache_blocksize, cache_assoc, cache_blockoffsetbits, size,
+                branch_predict_taken ? "taken" : "not_taken", CACHE_MISS_DELAY,
+                victim_entries, dram_enabled);
+        fprintf(fp, "\"accesses\": %ld, \"misses\": %ld, \"hits\": %ld, \"victim_hits\": %ld, "
+                "\"compulsory\": %ld, \"capacity\": %ld, \"conflict\": %ld, "
+                "\"cycles\": %u, \"instructions\": %u, \"branches\": %u, "
+                "\"correct_predictions\": %u, ",
+                cache_access, cache_miss, cache_hit, victim_hit,
+                cache_miss_compulsory, cache_miss_capacity, cache_miss_conflict,
+                pipeline_cycles, instruction_count, branch_count, correct_branch_predictions);
+        fprintf(fp, "\"miss_rate\": %.6f, \"cpi\": %.6f, \"branch_accuracy\": %.6f, "
+                "\"wall_seconds\": %.6f, \"lines_per_sec\": %.0f}\n",
+                miss_rate, cpi, accuracy, seconds, rate);
+    }
+    else {
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) == 0)
+            fprintf(fp, "trace,index,blocksize,assoc,blockoffsetbits,cache_size,predictor,miss_delay,"
+                    "victim_entries,dram,accesses,misses,hits,victim_hits,compulsory,capacity,conflict,"
+                    "cycles,instructions,branches,correct_predictions,miss_rate,cpi,branch_accuracy,"
+                    "wall_seconds,lines_per_sec\n");
+        iplc_sim_results_name(fp, results_trace);
+        fprintf(fp, ",%d,%d,%d,%d,%lu,%s,%d,%d,%d,", cache_index, cache_blocksize, cache_assoc,
+                cache_blockoffsetbits, size, branch_predict_taken ? "taken" : "not_taken",
+                CACHE_MISS_DELAY, victim_entries, dram_enabled);
+        fprintf(fp, "%ld,%ld,%ld,%ld,%ld,%ld,%ld,%u,%u,%u,%u,", cache_access, cache_miss, cache_hit,
+                victim_hit, cache_miss_compulsory, cache_miss_capacity, cache_miss_conflict,
+                pipeline_cycles, instruction_count, branch_count, correct_branch_predictions);
+        fprintf(fp, "%.6f,%.6f,%.6f,%.6f,%.0f\n", miss_rate, cpi, accuracy, seconds, rate);
+    }
+}
+
+/************************************************************************************************/
+/* Profiling Functions **************************************************************************/
+/************************************************************************************************/
+
+char *profile_phase_name[PROFILE_PHASES] = {"other", "read", "parse", "trap", "push", "dump"};
+char *profile_event_name[PROFILE_EVENTS] = {"Cycles", "Instructions", "Cache Misses", "Branch Misses"};
+
+#ifdef __linux__
+long iplc_sim_perf_open(unsigned long long config, int group)
+{
+    struct perf_event_attr attr;
+    
+    bzero(&attr, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = (group == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+/*
+ * Open the hardware counters as one group so a single read() returns all
+ * of them.  Counters the host does not have are left out; with no cycle
+ * counter at all the profile falls back to the time stamp counter or, off
+ * x86, the monotonic clock.
+ */
+void iplc_sim_profile_init()
+{
+    int i;
+    
+    profile_fd = -1;
+    profile_source = "clock_gettime";
+#if defined(__x86_64__) || defined(__i386__)
+    profile_source = "rdtsc";
+#endif
+    
+#ifdef __linux__
+    {
+        unsigned long long config[PROFILE_EVENTS] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        
+        profile_fd = iplc_sim_perf_open(config[0], -1);
+        if (profile_fd >= 0) {
+            profile_have[0] = 1;
+            for (i = 1; i < PROFILE_EVENTS; i++) {
+                long fd = iplc_sim_perf_open(config[i], profile_fd);
+                profile_have[i] = (fd >= 0);
+            }
+            ioctl(profile_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            profile_source = "perf_event";
+        }
+    }
+#endif
+    if (profile_fd < 0)
+        profile_have[0] = 1;
+    
+    profile_depth = 0;
+    profile_stack[0] = PROFILE_OTHER;
+    iplc_sim_profile_read(profile_last);
+    atexit(iplc_sim_profile_report);
+}
+
+void iplc_sim_profile_read(unsigned long long *value)
+{
+    int i, n = 0;
+    
+#ifdef __linux__
+    if (profile_fd >= 0) {
+        unsigned long long buffer[PROFILE_EVENTS + 1];
+        
+        if (read(profile_fd, buffer, sizeof(buffer)) > 0) {
+            for (i = 0; i < PROFILE_EVENTS; i++)
+                value[i] = profile_have[i] ? buffer[1 + n++] : 0;
+        }
+        return;
+    }
+#endif
+    for (i = 1; i < PROFILE_EVENTS; i++)
+        value[i] = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    value[0] = __rdtsc();
+#else
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        value[0] = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+#endif
+}
+
+/*
+ * Time is charged to whichever phase is on top of the stack, so nested
+ * phases (a trap inside a push inside a parse) are counted exclusively.
+ */
+void iplc_sim_profile_charge()
+{
+    unsigned long long now[PROFILE_EVENTS];
+    int i, phase = profile_stack[profile_depth];
+    
+    iplc_sim_profile_read(now);
+    for (i = 0; i < PROFILE_EVENTS; i++) {
+        profile_total[phase][i] += now[i] - profile_last[i];
+        profile_last[i] = now[i];
+    }
+}
+
+void iplc_sim_profile_enter(int phase)
+{
+    iplc_sim_profile_charge();
+    if (profile_depth < PROFILE_DEPTH - 1)
+        profile_stack[++profile_depth] = phase;
+    profile_calls[phase]++;
+}
+
+void iplc_sim_profile_exit()
+{
+    iplc_sim_profile_charge();
+    if (profile_depth > 0)
+        profile_depth--;
+}
+
+/*
+ * fgets() of one trace line, counted as the read phase.
+ */
+char *iplc_sim_read_line(char *buffer, FILE *trace_file)
+{
+    char *line;
+    
+    if (profile_enabled)
+        iplc_sim_profile_enter(PROFILE_READ);
+    line = fgets(buffer, 80, trace_file);
+    if (profile_enabled)
+        iplc_sim_profile_exit();
+    return line;
+}
+
+void iplc_sim_profile_report()
+{
+    unsigned long long total = 0;
+    int phase, i;
+    
+    iplc_sim_profile_charge();
+    for (phase = 0; phase < PROFILE_PHASES; phase++)
+        total += profile_total[phase][0];
+    
+    printf(" Simulator Profile (%s%s) \n", profile_source,
+           profile_fd < 0 ? ", cycles are timer ticks" : "");
+    printf("\t %-6s %12s %8s", "Phase", "Calls", "Share");
+    for (i = 0; i < PROFILE_EVENTS; i++)
+        printf(" %14s", profile_event_name[i]);
+    printf(" %6s \n", "IPC");
+    for (phase = 0; phase < PROFILE_PHASES; phase++) {
+        printf("\t %-6s %12lu %7.2f%%", profile_phase_name[phase], profile_calls[phase],
+               total ? 100.0 * profile_total[phase][0] / total : 0.0);
+        for (i = 0; i < PROFILE_EVENTS; i++) {
+            if (profile_have[i])
+                printf(" %14llu", profile_total[phase][i]);
+            else
+                printf(" %14s", "n/a");
+        }
+        if (profile_have[1] && profile_total[phase][0])
+            printf(" %6.2f \n", (double)profile_total[phase][1] / profile_total[phase][0]);
+        else
+            printf(" %6s \n", "n/a");
+    }
+    printf("\n");
+}
+
+/************************************************************************************************/
+/* Multicore Functions **************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Parse "trace=file,trace=file,l2=8:8,l2hit=4,c2c=6,upgrade=2,quantum=1000".
+ * The trace given at the prompt runs on core 0, each trace= adds a core.
+ */
+void iplc_sim_mc_configure(char *spec)
+{
+    char *opt;
+    char key[32], value[1024];
+    
+    mc_cores = 1;
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (sscanf(opt, "%31[^=]=%1023s", key, value) != 2) {
+            printf("Bad multicore option: %s \n", opt);
+            exit(-1);
+        }
+        if (strcmp(key, "trace") == 0) {
+            if (mc_cores == MAX_CORES) {
+                printf("At most %d cores \n", MAX_CORES);
+                exit(-1);
+            }
+            mc_core[mc_cores++].trace_name = strdup(value);
+        }
+        else if (strcmp(key, "l2") == 0 && sscanf(value, "%d:%d", &l2_index, &l2_assoc) == 2 &&
+                 l2_index >= 0 && l2_index <= 20 && l2_assoc >= 1)
+            ;
+        else if (strcmp(key, "l2hit") == 0 && atoi(value) >= 1)
+            l2_hit_delay = atoi(value);
+        else if (strcmp(key, "c2c") == 0 && atoi(value) >= 1)
+            mc_c2c_delay = atoi(value);
+        else if (strcmp(key, "upgrade") == 0 && atoi(value) >= 0)
+            mc_upgrade_delay = atoi(value);
+        else if (strcmp(key, "quantum") == 0 && atoi(value) >= 1)
+            mc_quantum = atoi(value);
+        else {
+            printf("Unknown multicore option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    if (mc_cores < 2) {
+        printf("Multicore needs at least one trace= besides the prompted one \n");
+        exit(-1);
+    }
+}
+
+/*
+ * The shared L2 holds blocks of the L1 block size, LRU by last-use stamp.
+ */
+int iplc_sim_l2_access(unsigned int block)
+{
+    unsigned int set = block & ((1 << l2_index) - 1);
+    unsigned int *tag = l2_tag + set * l2_assoc;
+    unsigned long *stamp = l2_stamp + set * l2_assoc;
+    int w, lru = 0;
+    
+    l2_access++;
+    for (w = 0; w < l2_assoc; w++) {
+        if (stamp[w] && tag[w] == block) {
+            stamp[w] = ++l2_clock;
+            return 1;
+        }
+        if (stamp[w] < stamp[lru])
+            lru = w;
+    }
+    l2_miss++;
+    tag[lru] = block;
+    stamp[lru] = ++l2_clock;
+    return 0;
+}
+
+/*
+ * Way of another core's L1 holding this block, or -1.
+ */
+int iplc_sim_mc_lookup(int core, int index, int tag)
+{
+    cache_line_t *line = &mc_core[core].cache[index];
+    int w;
     
-    printf("Please enter the tracefile: ");
-    scanf("%s", trace_file_name);
+    for (w = 0; w < cache_assoc; w++)
+        if (line->assoc[w].vb && line->assoc[w].tag == tag)
+            return w;
+    return -1;
+}
+
+/*
+ * Snoop every other L1.  A write takes the block away from all of them;
+ * a read demotes M and E copies to S, and an M copy supplies the data.
+ * Returns 1 if another core had the block modified.
+ */
+int iplc_sim_mc_snoop(int index, int tag, int is_write, int *shared)
+{
+    int k, w, supplied = 0;
+    int *state;
     
-    trace_file = fopen(trace_file_name, "r");
+    *shared = 0;
+    for (k = 0; k < mc_cores; k++) {
+        if (k == mc_current || (w = iplc_sim_mc_lookup(k, index, tag)) < 0)
+            continue;
+        state = &mc_core[k].state[index * cache_assoc + w];
+        if (*state == MESI_M) {
+            supplied = 1;
+            mc_core[k].writebacks++;
+            iplc_sim_l2_access(((unsigned int)tag << cache_index) | index);
+        }
+        if (is_write) {
+            mc_core[k].cache[index].assoc[w].vb = 0;
+            *state = MESI_I;
+            mc_core[k].invalidations++;
+            mc_invalidations++;
+        }
+        else {
+            *state = MESI_S;
+            *shared = 1;
+        }
+    }
+    return supplied;
+}
+
+/*
+ * L1 miss on the current core: write back a modified victim, issue BusRd
+ * or BusRdX, and work out where the data comes from.  The state the new
+ * line takes is left in mc_fill_state.
+ */
+unsigned int iplc_sim_mc_miss(int index, int tag, int is_write)
+{
+    int lru = cache[index].replacement[0];
+    int shared;
     
-    if ( trace_file == NULL ) {
-        printf("fopen failed for %s file\n", trace_file_name);
+    if (cache[index].assoc[lru].vb && mc_state[index * cache_assoc + lru] == MESI_M) {
+        mc_core[mc_current].writebacks++;
+        iplc_sim_l2_access(((unsigned int)cache[index].assoc[lru].tag << cache_index) | index);
+    }
+    
+    if (is_write)
+        mc_bus_rdx++;
+    else
+        mc_bus_rd++;
+    
+    if (iplc_sim_mc_snoop(index, tag, is_write, &shared)) {
+        mc_c2c++;
+        mc_fill_state = is_write ? MESI_M : MESI_S;
+        return mc_c2c_delay;
+    }
+    mc_fill_state = is_write ? MESI_M : (shared ? MESI_S : MESI_E);
+    
+    if (iplc_sim_l2_access(((unsigned int)tag << cache_index) | index))
+        return l2_hit_delay;
+    return CACHE_MISS_DELAY;
+}
+
+/*
+ * L1 hit on the current core.  Writing a shared line costs a bus upgrade
+ * that invalidates the other copies; E goes to M silently.
+ */
+void iplc_sim_mc_hit(int index, int way, int is_write)
+{
+    int *state = &mc_state[index * cache_assoc + way];
+    int shared;
+    
+    if (!is_write)
+        return;
+    if (*state == MESI_S) {
+        mc_bus_upgr++;
+        iplc_sim_mc_snoop(index, cache[index].assoc[way].tag, 1, &shared);
+        pipeline_cycles += mc_upgrade_delay;
+    }
+    *state = MESI_M;
+}
+
+/*
+ * Cores take turns owning the simulator's globals.
+ */
+void iplc_sim_mc_switch_in(int k)
+{
+    mc_core_t *core = &mc_core[k];
+    
+    mc_current = k;
+    cache = core->cache;
+    fast_valid = 0;
+    mc_state = core->state;
+    memcpy(pipeline, core->pipeline, sizeof(pipeline));
+    cache_access = core->cache_access;
+    cache_miss = core->cache_miss;
+    cache_hit = core->cache_hit;
+    pipeline_cycles = core->pipeline_cycles;
+    instruction_count = core->instruction_count;
+    branch_count = core->branch_count;
+    correct_branch_predictions = core->correct_branch_predictions;
+    instruction_address = core->instruction_address;
+    miss_delay = core->miss_delay;
+    trace_line = core->trace_line;
+}
+
+void iplc_sim_mc_switch_out(int k)
+{
+    mc_core_t *core = &mc_core[k];
+    
+    memcpy(core->pipeline, pipeline, sizeof(pipeline));
+    core->cache_access = cache_access;
+    core->cache_miss = cache_miss;
+    core->cache_hit = cache_hit;
+    core->pipeline_cycles = pipeline_cycles;
+    core->instruction_count = instruction_count;
+    core->branch_count = branch_count;
+    core->correct_branch_predictions = correct_branch_predictions;
+    core->instruction_address = instruction_address;
+    core->miss_delay = miss_delay;
+    core->trace_line = trace_line;
+}
+
+/*
+ * Quantum-synchronised run: in each window of mc_quantum cycles every core
+ * in turn runs until its clock passes the end of the window, so no core
+ * gets more than a quantum ahead of another.
+ */
+void iplc_sim_mc_run(FILE *trace_file)
+{
+    char buffer[80];
+    unsigned long window;
+    int k, running;
+    
+    if (victim_entries || dram_enabled || classify_misses || reuse_profile) {
+        printf("Multicore runs do not combine with -v, -M, -c or -r \n");
+        exit(-1);
+    }
+    trace_output = 0;
+    dump_pipeline = 0;
+    
+    l2_tag = (unsigned int *)calloc((1 << l2_index) * l2_assoc, sizeof(unsigned int));
+    l2_stamp = (unsigned long *)calloc((1 << l2_index) * l2_assoc, sizeof(unsigned long));
+    
+    // core 0 keeps the cache iplc_sim_init() built, the others get their own
+    mc_core[0].file = trace_file;
+    for (k = 0; k < mc_cores; k++) {
+        if (k > 0) {
+            mc_core[k].file = fopen(mc_core[k].trace_name, "r");
+            if (mc_core[k].file == NULL) {
+                printf("fopen failed for %s file\n", mc_core[k].trace_name);
+                exit(-1);
+            }
+            cache = NULL;
+            iplc_sim_build_cache(cache_index, cache_assoc);
+        }
+        mc_core[k].cache = cache;
+        mc_core[k].state = (int *)calloc((1 << cache_index) * cache_assoc, sizeof(int));
+        mc_core[k].miss_delay = CACHE_MISS_DELAY;
+    }
+    
+    for (window = mc_quantum, running = mc_cores; running; window += mc_quantum) {
+        running = 0;
+        for (k = 0; k < mc_cores; k++) {
+            if (mc_core[k].done)
+                continue;
+            iplc_sim_mc_switch_in(k);
+            while (pipeline_cycles < window) {
+                if (fgets(buffer, 80, mc_core[k].file) == NULL) {
+                    iplc_sim_drain_pipeline();
+                    mc_core[k].done = 1;
+                    break;
+                }
+                iplc_sim_parse_instruction(buffer);
+                trace_line++;
+            }
+            iplc_sim_mc_switch_out(k);
+            running += !mc_core[k].done;
+        }
+    }
+    
+    printf(" Multicore Performance (%d cores, quantum %d cycles) \n", mc_cores, mc_quantum);
+    printf("\t %-4s %10s %10s %10s %9s %10s %12s %10s \n", "Core", "Instrs", "Cycles", "CPI",
+           "Accesses", "Misses", "Invalidated", "Writebacks");
+    for (k = 0; k < mc_cores; k++) {
+        mc_core_t *core = &mc_core[k];
+        printf("\t %-4d %10u %10u %10f %9ld %10ld %12ld %10ld \n", k, core->instruction_count,
+               core->pipeline_cycles, (double)core->pipeline_cycles / core->instruction_count,
+               core->cache_access, core->cache_miss, core->invalidations, core->writebacks);
+    }
+    printf("\n");
+    printf(" Coherence Traffic (MESI) \n");
+    printf("\t BusRd is %ld \n", mc_bus_rd);
+    printf("\t BusRdX is %ld \n", mc_bus_rdx);
+    printf("\t BusUpgr is %ld \n", mc_bus_upgr);
+    printf("\t Invalidations is %ld \n", mc_invalidations);
+    printf("\t Cache to Cache Transfers is %ld \n\n", mc_c2c);
+    printf(" Shared L2 Performance \n");
+    printf("\t L2 Geometry is %d sets, %d ways \n", 1 << l2_index, l2_assoc);
+    printf("\t Number of L2 Accesses is %ld \n", l2_access);
+    printf("\t Number of L2 Misses is %ld \n", l2_miss);
+    printf("\t L2 Miss Rate is %f \n\n", l2_access ? (double)l2_miss / l2_access : 0.0);
+}
+
+/************************************************************************************************/
+/* Server Functions *****************************************************************************/
+/************************************************************************************************/
+
+/*
+ * Parse "socket=path,workers=4,trace=id:file,trace=id:file".
+ */
+void iplc_sim_server_configure(char *spec)
+{
+    char *opt;
+    char key[32], value[1024];
+    
+    for (opt = strtok(spec, ","); opt != NULL; opt = strtok(NULL, ",")) {
+        if (sscanf(opt, "%31[^=]=%1023s", key, value) != 2) {
+            printf("Bad server option: %s \n", opt);
+            exit(-1);
+        }
+        if (strcmp(key, "socket") == 0)
+            server_socket = strdup(value);
+        else if (strcmp(key, "workers") == 0 && atoi(value) >= 1)
+            server_workers = atoi(value);
+        else if (strcmp(key, "trace") == 0 && strchr(value, ':') != NULL) {
+            if (server_traces == MAX_SERVER_TRACES) {
+                printf("At most %d traces \n", MAX_SERVER_TRACES);
+                exit(-1);
+            }
+            *strchr(value, ':') = '\0';
+            sprintf(server_trace[server_traces].name, "%.63s", value);
+            server_trace[server_traces].file = strdup(value + strlen(value) + 1);
+            server_traces++;
+        }
+        else {
+            printf("Unknown server option: %s \n", opt);
+            exit(-1);
+        }
+    }
+    if (server_socket == NULL || server_traces == 0) {
+        printf("Server needs socket= and at least one trace= \n");
+        exit(-1);
+    }
+    server_mode = 1;
+}
+
+/*
+ * Decode a whole trace up front.  Workers are forked after this, so they
+ * all share the decoded copy.
+ */
+void iplc_sim_server_load(server_trace_t *trace)
+{
+    FILE *fp = fopen(trace->file, "r");
+    char buffer[80];
+    long size = 1024;
+    
+    if (fp == NULL) {
+        printf("fopen failed for %s file\n", trace->file);
         exit(-1);
     }
+    trace->code = (decoded_instruction_t *)malloc(sizeof(decoded_instruction_t) * size);
+    trace->count = 0;
+    while (fgets(buffer, 80, fp) != NULL) {
+        if (trace->count == size) {
+            size *= 2;
+            trace->code = (decoded_instruction_t *)realloc(trace->code,
+                                                           sizeof(decoded_instruction_t) * size);
+        }
+        iplc_sim_decode_instruction(buffer, &trace->code[trace->count++]);
+    }
+    fclose(fp);
+}
+
+/*
+ * Answer one request line with one JSON line.  A request is either
+ * "traces" or space separated settings such as
+ * "trace=sample index=2 blocksize=2 assoc=2 predict=1 victim=0".
+ */
+void iplc_sim_server_request(char *request, FILE *out)
+{
+    char *opt;
+    char key[32], value[64], name[64] = "";
+    int index = -1, blocksize = -1, assoc = -1, predict = 0, victims = 0;
+    int t, found = -1;
+    long i;
+    
+    if (strncmp(request, "traces", 6) == 0) {
+        fprintf(out, "{\"traces\": [");
+        for (t = 0; t < server_traces; t++)
+            fprintf(out, "%s{\"id\": \"%s\", \"lines\": %ld}", t ? ", " : "",
+                    server_trace[t].name, server_trace[t].count);
+        fprintf(out, "]}\n");
+        return;
+    }
     
-    printf("Enter Cache Size (index), Blocksize and Level of Assoc \n");
-    scanf( "%d %d %d", &index, &blocksize, &assoc );
+    for (opt = strtok(request, " \t\r\n"); opt != NULL; opt = strtok(NULL, " \t\r\n")) {
+        if (sscanf(opt, "%31[^=]=%63s", key, value) != 2) {
+            fprintf(out, "{\"error\": \"bad setting\"}\n");
+            return;
+        }
+        if (strcmp(key, "trace") == 0)
+            strcpy(name, value);
+        else if (strcmp(key, "index") == 0)
+            index = atoi(value);
+        else if (strcmp(key, "blocksize") == 0)
+            blocksize = atoi(value);
+        else if (strcmp(key, "assoc") == 0)
+            assoc = atoi(value);
+        else if (strcmp(key, "predict") == 0)
+            predict = atoi(value);
+        else if (strcmp(key, "victim") == 0)
+            victims = atoi(value);
+        else {
+            fprintf(out, "{\"error\": \"unknown setting\"}\n");
+            return;
+        }
+    }
     
-    printf("Enter Branch Prediction: 0 (NOT taken), 1 (TAKEN): ");
-    scanf("%d", &branch_predict_taken );
+    for (t = 0; t < server_traces; t++)
+        if (strcmp(server_trace[t].name, name) == 0)
+            found = t;
+    if (found < 0) {
+        fprintf(out, "{\"error\": \"unknown trace\"}\n");
+        return;
+    }
+    if (index < 0 || index > 20 || blocksize < 1 || assoc < 1 ||
+        victims < 0 || victims > MAX_VICTIM_ENTRIES) {
+        fprintf(out, "{\"error\": \"index, blocksize and assoc are required\"}\n");
+        return;
+    }
+    if (iplc_sim_cache_size(index, blocksize, assoc) > MAX_CACHE_SIZE) {
+        fprintf(out, "{\"error\": \"cache too big\"}\n");
+        return;
+    }
     
+    free(victim);
+    victim = NULL;
+    victim_entries = victims;
+    branch_predict_taken = predict;
     iplc_sim_init(index, blocksize, assoc);
+    iplc_sim_reset();
     
-    while (fgets(buffer, 80, trace_file) != NULL) {
-        iplc_sim_parse_instruction(buffer);
-        if (dump_pipeline)
+    results_start = iplc_sim_wall_time();
+    strcpy(results_trace, server_trace[found].name);
+    for (i = 0; i < server_trace[found].count; i++)
+        iplc_sim_execute_instruction(&server_trace[found].code[i]);
+    trace_line = server_trace[found].count;
+    iplc_sim_finalize();
+    
+    results_format = RESULTS_JSON;
+    iplc_sim_results_record(out);
+    results_format = RESULTS_NONE;
+}
+
+/*
+ * Worker loop: connections are taken straight off the shared listening
+ * socket, and a connection may carry any number of requests.
+ */
+void iplc_sim_server_worker(int listener)
+{
+    char request[1024];
+    int conn;
+    FILE *in, *out;
+    
+    // the report text of every run would otherwise land on the server's terminal
+    if (freopen("/dev/null", "w", stdout) == NULL)
+        _exit(1);
+    trace_output = 0;
+    dump_pipeline = 0;
+    results_format = RESULTS_NONE;
+    
+    for (;;) {
+        conn = accept(listener, NULL, NULL);
+        if (conn < 0)
+            continue;
+        in = fdopen(conn, "r");
+        out = fdopen(dup(conn), "w");
+        while (fgets(request, sizeof(request), in) != NULL) {
+            iplc_sim_server_request(request, out);
+            fflush(out);
+        }
+        fclose(in);
+        fclose(out);
+    }
+}
+
+void iplc_sim_server_stop(int sig)
+{
+    server_stopping = 1;
+}
+
+/*
+ * Load the traces, then keep server_workers forked workers running until
+ * SIGINT or SIGTERM.  Workers are processes rather than threads because
+ * the simulator's state is global.
+ */
+void iplc_sim_server_run()
+{
+    struct sockaddr_un addr;
+    pid_t *worker;
+    pid_t pid;
+    int listener, t, k;
+    struct sigaction stop;
+    
+    for (t = 0; t < server_traces; t++) {
+        iplc_sim_server_load(&server_trace[t]);
+        printf("Loaded trace %s: %ld lines \n", server_trace[t].name, server_trace[t].count);
+    }
+    
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    bzero(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, server_socket, sizeof(addr.sun_path) - 1);
+    unlink(server_socket);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listener, 128) < 0) {
+        printf("Cannot listen on %s \n", server_socket);
+        exit(-1);
+    }
+    
+    // no SA_RESTART, so a signal breaks wait() and the loop sees server_stopping
+    bzero(&stop, sizeof(stop));
+    stop.sa_handler = iplc_sim_server_stop;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    
+    printf("Listening on %s with %d workers \n", server_socket, server_workers);
+    fflush(stdout);
+    
+    worker = (pid_t *)calloc(server_workers, sizeof(pid_t));
+    while (!server_stopping) {
+        // start missing workers, including any that died
+        for (k = 0; k < server_workers; k++) {
+            if (worker[k] == 0) {
+                pid = fork();
+                if (pid == 0) {
+                    signal(SIGINT, SIG_DFL);
+                    signal(SIGTERM, SIG_DFL);
+                    iplc_sim_server_worker(listener);
+                }
+                worker[k] = pid > 0 ? pid : 0;
+            }
+        }
+        pid = wait(NULL);
+        for (k = 0; k < server_workers; k++)
+            if (pid > 0 && worker[k] == pid)
+                worker[k] = 0;
+    }
+    
+    for (k = 0; k < server_workers; k++) {
+        if (worker[k] > 0) {
+            kill(worker[k], SIGTERM);
+            waitpid(worker[k], NULL, 0);
+        }
+    }
+    close(listener);
+    unlink(server_socket);
+    printf("Server stopped \n");
+}
+
+/************************************************************************************************/
+/* MAIN Function ********************************************************************************/
+/************************************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    char trace_file_name[1024];
+    FILE *trace_file = NULL;
+    char buffer[80];
+    int index = 10;
+    int blocksize = 1;
+    int assoc = 1;
+    int opt;
+    long checkpoint_line = 0;
+    char checkpoint_file[1024] = "";
+    char *restore_file = NULL;
+    char *timeline_name = NULL;
+    char *ztrace_name = NULL;
+    
+    while ((opt = getopt(argc, argv, "qcrpbLv:M:V:T:X:F:Z:s:P:j:m:E:C:o:D:S:R:")) != -1) {
+        switch (opt) {
+            case 'q':
+                trace_output = 0;
+                dump_pipeline = 0;
+                break;
+            case 'c':
+                classify_misses = 1;
+                break;
+            case 'r':
+                reuse_profile = 1;
+                break;
+            case 'p':
+                profile_enabled = 1;
+                break;
+            case 'b':
+                block_mode = 1;
+                break;
+            case 'L':
+                loop_mode = 1;
+                break;
+            case 'v':
+                victim_entries = atoi(optarg);
+                if (victim_entries < 1 || victim_entries > MAX_VICTIM_ENTRIES) {
+                    printf("Victim cache must have 1 to %d entries \n", MAX_VICTIM_ENTRIES);
+                    exit(-1);
+                }
+                break;
+            case 'M':
+                iplc_sim_dram_configure(optarg);
+                break;
+            case 'V':
+                iplc_sim_tlb_configure(optarg);
+                break;
+            case 'T':
+                iplc_sim_trigger_configure(optarg);
+                break;
+            case 'X':
+                timeline_name = optarg;
+                break;
+            case 'F':
+                iplc_sim_func_configure(optarg);
+                break;
+            case 'Z':
+                ztrace_name = optarg;
+                break;
+            case 's':
+                iplc_sim_sample_configure(optarg);
+                break;
+            case 'P':
+                iplc_sim_phase_configure(optarg);
+                break;
+            case 'j':
+                iplc_sim_parallel_configure(optarg);
+                break;
+            case 'm':
+                iplc_sim_multi_configure(optarg);
+                break;
+            case 'E':
+                iplc_sim_explore_configure(optarg);
+                break;
+            case 'C':
+                iplc_sim_mc_configure(optarg);
+                break;
+            case 'o':
+                iplc_sim_results_configure(optarg);
+                break;
+            case 'D':
+                iplc_sim_server_configure(optarg);
+                break;
+            case 'S':
+                if (sscanf(optarg, "%ld:%1023s", &checkpoint_line, checkpoint_file) != 2 ||
+                    checkpoint_line < 1) {
+                    printf("Checkpoint must be given as line:file \n");
+                    exit(-1);
+                }
+                break;
+            case 'R':
+                restore_file = optarg;
+                break;
+            default:
+                printf("Usage: %s [-q] [-c] [-r] [-p] [-b] [-L] [-v entries] [-M dram-options] \n"
+                       "       [-V tlb-options] [-T trigger-options] [-X timeline] [-F program-options] \n"
+                       "       [-s sample-options] [-P phase-options] [-j parallel-options] \n"
+                       "       [-m index:assoc,...] [-E explore-options] [-C multicore-options] \n"
+                       "       [-o format:file] [-D server-options] [-S line:checkpoint] \n"
+                       "       [-R checkpoint] [-Z compressed-trace] \n", argv[0]);
+                printf("\t -q   no per cycle or per access output \n");
+                printf("\t -c   classify misses as compulsory, capacity or conflict \n");
+                printf("\t -r   reuse distance histogram and fully associative miss curve \n");
+                printf("\t -p   per phase hardware counter profile of the simulator itself \n");
+                printf("\t -b   retire runs of ALU ops and nops that hit in one cache block in bulk, needs -q; \n");
+                printf("\t      loads, stores and branches are still simulated one at a time \n");
+                printf("\t -L   skip loop iterations that repeat a steady state exactly, needs -q \n");
+                printf("\t -v   add a fully associative victim cache of 1-%d entries \n", MAX_VICTIM_ENTRIES);
+                printf("\t -M   DRAM timing, e.g. banks=8,row=2048,hit=4,miss=8,conflict=12,bw=4,queue=16,sched=frfcfs \n");
+                printf("\t -V   translate through TLBs, e.g. itlb=16,dtlb=32,l2tlb=512:4,page=4096,l1hit=1,l2hit=6,walk=30,index=vipt,map=seq \n");
+                printf("\t -T   print windows around triggers, e.g. pc=400264-400300,cycle=1000-2000,imiss=5,dmiss=3,stall=2,mispredict=10,miss=10010040,pre=16,post=16 \n");
+                printf("\t -X   write the pipeline timeline as Chrome trace events, for chrome://tracing or Perfetto \n");
+                printf("\t -F   execute a program instead of a trace, e.g. program=prog.s,entry=0x400000,sp=0x7fffeffc,max=1000000,dump=run.txt \n");
+                printf("\t -s   sampled simulation, e.g. unit=1000,warm=2000,samples=30,error=0.03,conf=99.7 \n");
+                printf("\t -P   simulate one interval per phase, e.g. interval=1000,maxk=8,warm=2000 \n");
+                printf("\t -j   split the trace over processes, e.g. chunks=4,warm=10000,verify=1 \n");
+                printf("\t -m   more geometries at the same block size in one pass, e.g. 3:1,1:4,verify \n");
+                printf("\t -E   Pareto frontier of all geometries under a budget, e.g. budget=8192,objective=cpi,slack=0.05,verify \n");
+                printf("\t -C   more cores with MESI L1s over a shared L2, e.g. trace=b.txt,l2=8:8,l2hit=4,c2c=6,upgrade=2,quantum=1000 \n");
+                printf("\t -o   append results of a plain run as json:file or csv:file \n");
+                printf("\t -D   serve runs on a Unix socket, e.g. socket=/tmp/iplc.sock,workers=4,trace=sample:instruction-trace.txt \n");
+                printf("\t -S   save a checkpoint after the given trace line and stop \n");
+                printf("\t -R   resume from a checkpoint instead of prompting \n");
+                printf("\t -Z   write the trace as a compressed trace and stop; compressed traces are read like text ones \n");
+                exit(-1);
+        }
+    }
+    
+    if (block_mode) {
+        // bulk retirement skips the per access hooks and the per cycle output
+        if (trace_output || dump_pipeline || classify_misses || reuse_profile) {
+            printf("Basic block mode needs -q and cannot be combined with -c or -r \n");
+            exit(-1);
+        }
+        if (sample_mode || phase_mode || parallel_chunks || multi_mode || explore_mode ||
+            mc_cores || server_mode) {
+            printf("Basic block mode only applies to a plain run \n");
+            exit(-1);
+        }
+    }
+    
+    if (loop_mode) {
+        // the per cycle output, the time dependent features and checkpoints need every line simulated
+        if (trace_output || dump_pipeline || classify_misses || reuse_profile || victim_entries ||
+            dram_enabled || checkpoint_line) {
+            printf("Loop mode needs -q and cannot be combined with -c, -r, -v, -M or -S \n");
+            exit(-1);
+        }
+        if (sample_mode || phase_mode || parallel_chunks || multi_mode || explore_mode ||
+            mc_cores || server_mode) {
+            printf("Loop mode only applies to a plain run \n");
+            exit(-1);
+        }
+    }
+    
+    if (trigger_mode) {
+        // the windows decide what is printed
+        if (block_mode || loop_mode || sample_mode || phase_mode || parallel_chunks || multi_mode ||
+            explore_mode || mc_cores || server_mode) {
+            printf("Triggered tracing only applies to a plain run \n");
+            exit(-1);
+        }
+        trace_output = 0;
+        dump_pipeline = 0;
+    }
+    
+    if (tlb_enabled) {
+        // only the plain pipeline translates, and checkpoints do not carry the TLBs
+        if (block_mode || loop_mode || sample_mode || phase_mode || parallel_chunks || multi_mode ||
+            explore_mode || mc_cores || server_mode || restore_file || checkpoint_line) {
+            printf("TLB translation only applies to a plain run without checkpoints \n");
+            exit(-1);
+        }
+    }
+    
+    if (timeline_name) {
+        // every push has to go through iplc_sim_push_pipeline_stage()
+        if (block_mode || loop_mode || sample_mode || phase_mode || parallel_chunks || multi_mode ||
+            explore_mode || mc_cores || server_mode || restore_file) {
+            printf("The timeline only applies to a plain run \n");
+            exit(-1);
+        }
+        iplc_sim_timeline_open(timeline_name);
+    }
+    
+    if (func_mode) {
+        // the program is executed once, start to finish
+        if (loop_mode || sample_mode || phase_mode || parallel_chunks || multi_mode || explore_mode ||
+            mc_cores || server_mode || restore_file || checkpoint_line) {
+            printf("The functional front-end only applies to a plain run without checkpoints \n");
+            exit(-1);
+        }
+        iplc_sim_func_load();
+    }
+    
+    if (parallel_chunks) {
+        // only the counters every run produces come back from the workers
+        if (victim_entries || dram_enabled || classify_misses || reuse_profile) {
+            printf("Parallel simulation cannot be combined with -v, -M, -c or -r \n");
+            exit(-1);
+        }
+    }
+    
+    if (results_format != RESULTS_NONE) {
+        // a record is written by iplc_sim_finalize(), once per plain run
+        if (sample_mode || phase_mode || parallel_chunks || multi_mode || explore_mode || mc_cores) {
+            printf("Results files only apply to a plain run \n");
+            exit(-1);
+        }
+    }
+    
+    if (ztrace_name && (func_mode || restore_file || server_mode)) {
+        printf("Compressing needs a trace to read \n");
+        exit(-1);
+    }
+    
+    if (explore_mode) {
+        // every geometry is simulated plain
+        if (victim_entries || dram_enabled || classify_misses || reuse_profile || restore_file ||
+            sample_mode || phase_mode || parallel_chunks || multi_mode || mc_cores || server_mode) {
+            printf("Exploration cannot be combined with other modes or cache features \n");
+            exit(-1);
+        }
+    }
+    
+    if (server_mode) {
+        iplc_sim_server_run();
+        return 0;
+    }
+    
+    if (restore_file) {
+        // geometry, features and trace position all come from the checkpoint
+        trace_file = iplc_sim_checkpoint_restore(restore_file, trace_file_name);
+    }
+    else if (func_mode) {
+        // the program takes the place of the trace
+        strcpy(trace_file_name, func_program);
+        
+        printf("Enter Cache Size (index), Blocksize and Level of Assoc \n");
+        scanf( "%d %d %d", &index, &blocksize, &assoc );
+        
+        printf("Enter Branch Prediction: 0 (NOT taken), 1 (TAKEN): ");
+        scanf("%d", &branch_predict_taken );
+        
+        iplc_sim_init(index, blocksize, assoc);
+    }
+    else {
+        printf("Please enter the tracefile: ");
+        scanf("%s", trace_file_name);
+        
+        trace_file = fopen(trace_file_name, "r");
+        
+        if ( trace_file == NULL ) {
+            printf("fopen failed for %s file\n", trace_file_name);
+            exit(-1);
+        }
+        
+        if (ztrace_name) {
+            iplc_sim_ztrace_write(trace_file, ztrace_name);
+            return 0;
+        }
+        if (iplc_sim_ztrace_open(trace_file_name)) {
+            // decoded lines only go straight into the pipeline
+            if (loop_mode || sample_mode || phase_mode || multi_mode || explore_mode || mc_cores ||
+                checkpoint_line) {
+                printf("Compressed traces only apply to plain and parallel runs without checkpoints \n");
+                exit(-1);
+            }
+        }
+        
+        // exploration picks the geometries itself
+        if (!explore_mode) {
+            printf("Enter Cache Size (index), Blocksize and Level of Assoc \n");
+            scanf( "%d %d %d", &index, &blocksize, &assoc );
+        }
+        
+        printf("Enter Branch Prediction: 0 (NOT taken), 1 (TAKEN): ");
+        scanf("%d", &branch_predict_taken );
+        
+        if (explore_mode) {
+            iplc_sim_explore_run(trace_file);
+            return 0;
+        }
+        iplc_sim_init(index, blocksize, assoc);
+    }
+    
+    strcpy(results_trace, trace_file_name);
+    results_start = iplc_sim_wall_time();
+    if (profile_enabled)
+        iplc_sim_profile_init();
+    
+    if (sample_mode) {
+        iplc_sim_sample_run(trace_file);
+        return 0;
+    }
+    if (phase_mode) {
+        iplc_sim_phase_run(trace_file);
+        return 0;
+    }
+    if (parallel_chunks) {
+        iplc_sim_parallel_run(trace_file, trace_file_name);
+        return 0;
+    }
+    if (multi_mode) {
+        iplc_sim_multi_run(trace_file);
+        return 0;
+    }
+    if (mc_cores) {
+        iplc_sim_mc_run(trace_file);
+        return 0;
+    }
+    if (func_mode) {
+        iplc_sim_func_run();
+        iplc_sim_finalize();
+        return 0;
+    }
+    if (ztrace_mode) {
+        iplc_sim_ztrace_run();
+        iplc_sim_finalize();
+        return 0;
+    }
+    
+    while (iplc_sim_read_line(buffer, trace_file) != NULL) {
+        if (loop_mode)
+            iplc_sim_loop_step(buffer, trace_file);
+        else
+            iplc_sim_parse_instruction(buffer);
+        if (trigger_mode)
+            iplc_sim_trigger_line();
+        if (dump_pipeline) {
+            if (profile_enabled)
+                iplc_sim_profile_enter(PROFILE_DUMP);
             iplc_sim_dump_pipeline();
+            if (profile_enabled)
+                iplc_sim_profile_exit();
+        }
+        
+        trace_line++;
+        if (trace_line == checkpoint_line) {
+            iplc_sim_checkpoint_save(checkpoint_file, trace_file_name, ftell(trace_file));
+            return 0;
+        }
     }
     
     iplc_sim_finalize();